@@ -4,20 +4,40 @@
   (c) Kai Tomerius, 2017
  */
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <linux/fs.h>
+#include <linux/mempolicy.h>
+#include <math.h>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 static int verbose = 0;
 
+// set by SIGUSR1 to dump statistics of a running executor or escalation
+static volatile sig_atomic_t statistics = 0;
+
 // helper macro
 #define min(a, b) ((a)<(b)? (a) : (b))
 
@@ -62,65 +82,139 @@ static int verbose = 0;
 #define LOSS     0x04
 #define EOHT     0xff
 
+// no move, e.g. in training records of unresolved positions
+#define NOMOVE   0xff
+
+// maximum length of the search path checked for repetitions
+#define PATH 256
+
+// lowest score of a proven win, static evaluations stay below
+#define PROVEN 1000
+
+// maximum number of moves in a position
+#define MOVES 128
+
 typedef unsigned char uint8;
+typedef unsigned short uint16;
 typedef unsigned int uint32;
 typedef unsigned long long uint64;
+typedef long long int64;
 
-// hashtable in memory or on disk
-class Hashtable {
+// handle to a table of positions; tables can be chained, a lookup that
+// misses (finds no win or loss) falls through to the next table, results
+// are entered into every table of the chain that holds the hashvalue
+class Table {
 private:
-    static Hashtable* instance;
-    static uint64 won;
-    static uint64 lost;
-    static uint64 queried;
-    static uint64 matched;
+    static std::atomic<uint64> won;
+    static std::atomic<uint64> lost;
+    static std::atomic<uint64> queried;
+    static std::atomic<uint64> matched;
 
-    uint64 size;
-    int fd;
-    uint8* map;
+    Table* next;
 
-    void flush() {
-        if (fd>0) {
-            if (map) {
-                munmap(map, S);
-            }
+protected:
+    // entry of a hashvalue in this table, ILLEGAL if it has none
+    virtual uint8 get(uint64) {
+        return ILLEGAL;
+    }
 
-            close(fd);
-            sync();
-        } else {
-            if (map) {
-                free(map);
+    // store an entry unless the table has a win or loss for the hashvalue
+    // already, atomically as other threads enter results at the same time;
+    // read-only tables ignore it
+    virtual void put(uint64, uint8) {
+    }
+
+    // keep an entry found further down the chain, for caches
+    virtual void keep(uint64, uint8) {
+    }
+
+    // whether this table has an entry for a hashvalue, entries are written
+    // to all tables that hold them
+    virtual int holds(uint64) {
+        return 0;
+    }
+
+public:
+    // table of no positions, for searches without a table
+    static Table none;
+
+    // print the count of queries and matches every 1000 matches, off where
+    // the output is read by a player or a program
+    static int progress;
+
+    Table()
+        : next(NULL) {
+    }
+
+    virtual ~Table() {
+    }
+
+    // consult another table on a miss
+    Table& chain(Table& table) {
+        next = &table;
+        return *this;
+    }
+
+    // whether any table of the chain has an entry for a hashvalue
+    int covers(uint64 h) {
+        return holds(h) || (next && next->covers(h));
+    }
+
+    // read the entry of a hashvalue without updating it, from the first
+    // table of the chain with a result
+    uint8 probe(uint64 h) {
+        uint8 m = get(h);
+        if (!(m & (WIN | LOSS)) && next) {
+            uint8 n = next->probe(h);
+            if ((n & (WIN | LOSS)) || m==ILLEGAL) {
+                keep(h, n);
+                m = n;
             }
         }
 
-        map = NULL;
+        return m;
     }
 
-public:
-    static uint8 enter(uint64 h, int depth, int result) {
+    uint8 enter(uint64 h, int depth, int result) {
         uint8 m = result>0 ? (won++, WIN | LEGAL) : result<0 ? (lost++, LOSS | LEGAL) : LEGAL;
+        m |= (depth/2)<<3;
+        for (Table* t=this; t; t=t->next) {
+            if (t->holds(h)) {
+                t->put(h, m);
+            }
+        }
 
-        return instance && instance->map && instance->size>h ?
-            (*instance)[h] = ((depth/2)<<3) | m : m;
+        return m;
     }
 
-    static int query(uint64 h, int depth, int* result) {
+    // look up a hashvalue, a miss marks the depth in advance unless mark is
+    // 0 and leaves the entry found in previous
+    int query(uint64 h, int depth, int* result, uint8* previous=NULL, int mark=1) {
         queried++;
-        if (instance && instance->map && instance->size>h) {
-            if ((*instance)[h] & (WIN | LOSS)) {
-                *result = (*instance)[h] & WIN ? 1 : -1;
-            } else if (((*instance)[h]>>3)*2>=depth) {
+        if (covers(h)) {
+            uint8 m = probe(h);
+            if (previous) {
+                *previous = m;
+            }
+
+            if (m & (WIN | LOSS)) {
+                *result = m & WIN ? 1 : -1;
+            } else if ((m>>3)*2>=depth) {
                 *result = 0;
             } else {
-                if (((*instance)[h]>>3)<depth/2) {
-                    (*instance)[h] &= 0x07;
-                    (*instance)[h] |= ((depth/2)<<3);
+                if (mark && (m>>3)<depth/2) {
+                    // mark the depth in advance
+                    for (Table* t=this; t; t=t->next) {
+                        if (t->holds(h)) {
+                            t->put(h, (m & 0x07) | ((depth/2)<<3));
+                        }
+                    }
                 }
 
                 return 0;
             }
 
-            if (++matched%1000==0) {
+            if (++matched%1000==0 && progress) {
                 std::cout << queried << " queries, " <<  matched << " matches\r" << std::flush;
             }
 
@@ -145,10 +239,147 @@ public:
     static uint64 matches() {
         return matched;
     }
+};
+
+std::atomic<uint64> Table::won(0);
+std::atomic<uint64> Table::lost(0);
+std::atomic<uint64> Table::queried(0);
+std::atomic<uint64> Table::matched(0);
+Table Table::none;
+int Table::progress = 1;
+
+// RAM table of hot positions in front of a larger table, direct mapped, each
+// slot holding the hashvalue and its entry in one word
+class Cache : public Table {
+private:
+    int bits;
+    uint64* slots;
+
+    uint64& slot(uint64 h) {
+        return slots[(h*0x9e3779b97f4a7c15ULL)>>(64-bits)];
+    }
+
+protected:
+    uint8 get(uint64 h) {
+        uint64 s = __atomic_load_n(&slot(h), __ATOMIC_RELAXED);
+        return s>>8==h+1 ? s & 0xff : ILLEGAL;
+    }
+
+    void put(uint64 h, uint8 m) {
+        uint64& s = slot(h);
+        uint64 old = __atomic_load_n(&s, __ATOMIC_RELAXED);
+        while (!(old>>8==h+1 && (old & (WIN | LOSS))) &&
+               !__atomic_compare_exchange_n(&s, &old, (h+1)<<8 | m, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+    }
+
+    void keep(uint64 h, uint8 m) {
+        if (m!=ILLEGAL) {
+            put(h, m);
+        }
+    }
+
+    int holds(uint64 h) {
+        return slots && h<S;
+    }
+
+public:
+    // a cache of the largest power of two slots that fits in size bytes
+    Cache(uint64 size)
+        : bits(0), slots(NULL) {
+        while ((sizeof(uint64)<<(bits+1))<=size && bits<40) {
+            bits++;
+        }
+
+        if (size>=2*sizeof(uint64)) {
+            slots = (uint64*) calloc(1ULL<<bits, sizeof(uint64));
+        }
+    }
+
+    ~Cache() {
+        free(slots);
+    }
+
+    operator void*() {
+        return slots;
+    }
+};
+
+// hashtable in memory or on disk
+class Hashtable : public Table {
+private:
+    // open hashtables, to write them back on ^C
+    static Hashtable* opened;
+    Hashtable* link;
+
+    uint64 size;
+    int fd;
+    uint8* map;
+
+    void flush() {
+        if (fd>0) {
+            if (map) {
+                munmap(map, S);
+            }
+
+            close(fd);
+            sync();
+        } else {
+            if (map) {
+                free(map);
+            }
+        }
+
+        map = NULL;
+    }
 
+protected:
+    uint8 get(uint64 h) {
+        return map && size>h ? map[h] : ILLEGAL;
+    }
+
+    void put(uint64 h, uint8 m) {
+        uint8 old = __atomic_load_n(map+h, __ATOMIC_RELAXED);
+        while (!(old & (WIN | LOSS)) && old!=m &&
+               !__atomic_compare_exchange_n(map+h, &old, m, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+    }
+
+    int holds(uint64 h) {
+        return map && size>h;
+    }
+
+public:
+    // number of pages of the open hashtables in memory, out of a total of
+    // pages
+    static uint64 resident(uint64& pages) {
+        uint64 page = sysconf(_SC_PAGESIZE);
+        uint64 n = 0;
+        pages = 0;
+        for (Hashtable* t=opened; t; t=t->link) {
+            if (t->map) {
+                uint8* base = (uint8*) ((uint64) t->map & ~(page-1));
+                uint64 total = (t->map+t->size-base+page-1)/page;
+                pages += total;
+
+                // query a chunk of 1GB at a time
+                std::vector<unsigned char> in(1<<18);
+                for (uint64 k=0; k<total; k+=in.size()) {
+                    uint64 m = min(total-k, (uint64) in.size());
+                    if (mincore(base+k*page, m*page, &in[0])==0) {
+                        for (uint64 i=0; i<m; i++) {
+                            n += in[i] & 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        return n;
+    }
+
+    // write back all open hashtables
     static void unmap() {
-        if (instance) {
-            instance->flush();
+        for (Hashtable* t=opened; t; t=t->link) {
+            t->flush();
         }
     }
 
@@ -163,11 +394,18 @@ public:
             map = (uint8*) malloc(size);
         }
 
-        instance = this;
+        link = opened;
+        opened = this;
     }
 
     ~Hashtable() {
-        instance = NULL;
+        for (Hashtable** t=&opened; *t; t=&(*t)->link) {
+            if (*t==this) {
+                *t = link;
+                break;
+            }
+        }
+
         flush();
     }
 
@@ -175,510 +413,3794 @@ public:
         return map;
     }
 
+    // ask the kernel to read ahead a range of the mapped hashtable
+    void prefetch(uint64 start, uint64 stop) {
+        if (fd>0 && map) {
+            uint64 page = start & ~(sysconf(_SC_PAGESIZE)-1);
+            madvise(map+page, min(stop, size)-page, MADV_WILLNEED);
+        }
+    }
+
+    // schedule the write back of a range of the mapped hashtable
+    void commit(uint64 start, uint64 stop) {
+        if (fd>0 && map) {
+            uint64 page = start & ~(sysconf(_SC_PAGESIZE)-1);
+            msync(map+page, min(stop, size)-page, MS_ASYNC);
+        }
+    }
+
     uint8& operator[](uint64 n) {
         return map[n];
     }
 };
 
-Hashtable* Hashtable::instance = NULL;
-uint64 Hashtable::won = 0;
-uint64 Hashtable::lost = 0;
-uint64 Hashtable::queried = 0;
-uint64 Hashtable::matched = 0;
-
-class Board {
-private:
-    // lookup tables
-    static uint8 lionPosition[2*L];
-    static uint8 lionGrid[N][N];
-    static uint8 animal[4];
-
-    // pieces on the board and on hand
-    uint8 grid[N+D];
-    int sente;
-    int illegal;
-    int result;
+Hashtable* Hashtable::opened = NULL;
 
-    // iterate over a grid to find all pieces
-    class PieceIterator {
-    private:
-        uint8* grid;
-        uint32 i;
+// number of bit planes holding the search depth
+#define DEPTHBITS 5
 
-    public:
-        PieceIterator(uint8* grid)
-            : grid(grid), i(~0) {
-        }
+// hashtable split into dense bit planes for LEGAL, WIN, LOSS and the depth
+class Bitplanes {
+public:
+    enum { PLANE_LEGAL, PLANE_WIN, PLANE_LOSS, PLANE_DEPTH, PLANES=PLANE_DEPTH+DEPTHBITS };
 
-        operator void*() const {
-            return i<N+D ? (void*) this : NULL;
-        }
+private:
+    uint64 size;
+    uint64 words;
+    int fd;
+    uint64* map;
 
-        uint32 operator()() const {
-            return i;
-        }
+    uint64* plane(int p) {
+        return map+p*words;
+    }
 
-        uint8* operator&() const {
-            return grid;
+public:
+    // mask of the bits of word k within [start, stop)
+    static uint64 mask(uint64 k, uint64 start, uint64 stop) {
+        uint64 m = ~0ULL;
+        if (start>64*k) {
+            m &= ~0ULL<<(start-64*k);
         }
 
-        PieceIterator& operator++() {
-            while (++i<N+D && (!ANIMAL(grid[i]) || !SENTE(grid[i]) || (i>N && ANIMAL(grid[i])==ANIMAL(grid[i-1])))) ;
-            return *this;
+        if (stop<64*(k+1)) {
+            m &= ~(~0ULL<<(stop-64*k));
         }
-    };
 
-    // iterate around a piece to find all possible moves
-    class MoveIterator {
-    private:
-        uint8* grid;
-        uint32 n;
-        uint32 i;
+        return m;
+    }
 
-    public:
-        MoveIterator()
-            : grid(NULL), n(N), i(N) {
+    Bitplanes(uint64 size, const char* planesname=NULL)
+        : size(size), words((size+63)/64), fd(-1), map(NULL) {
+        uint64 bytes = PLANES*words*sizeof(uint64);
+        if (planesname &&
+            (fd = open(planesname, O_CREAT | O_LARGEFILE | O_RDWR, 0664))>0 &&
+            lseek(fd, bytes, SEEK_SET)==(off_t) bytes) {
+            write(fd, "", 1);
+            map = (uint64*) mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+            if (map==MAP_FAILED) {
+                map = NULL;
+            }
         }
+    }
 
-        MoveIterator& operator=(const MoveIterator& m) {
-            grid = m.grid;
-            n = m.n;
-            i = m.i;
-            return *this;
+    ~Bitplanes() {
+        if (map) {
+            munmap(map, PLANES*words*sizeof(uint64));
         }
 
-        MoveIterator& reset(const PieceIterator& p) {
-            grid = &p;
-            n = p();
-            i = p()<N ? p()<4 ? 4-p()-1 : ~0 : ~0;
-            return *this;
+        if (fd>0) {
+            close(fd);
         }
+    }
 
-        MoveIterator(const PieceIterator& p) {
-            reset(p);
-        }
+    operator void*() {
+        return map;
+    }
 
-        operator void*() const {
-            return
-                n<N ? i<9 && n-4+i<N ? (void*) this : NULL :
-                i<N ? (void*) this : NULL;
-        }
+    // word k of a plane, bit i holds hashvalue 64*k+i
+    uint64 word(int p, uint64 k) {
+        return plane(p)[k];
+    }
 
-        int operator==(uint32 l) {
-            return n<N ? n-4+i==l : i==l;
-        }
+    // test the bit of a hashvalue in one plane
+    int test(int p, uint64 h) {
+        return plane(p)[h/64]>>(h%64) & 1;
+    }
 
-        uint32 from() const {
-            return n;
+    // set bits of word k in one plane
+    void mark(int p, uint64 k, uint64 bits) {
+        if (bits) {
+            __atomic_fetch_or(&plane(p)[k], bits, __ATOMIC_RELAXED);
         }
+    }
 
-        uint32 to() const {
-            return n<N ? n-4+i : i;
+    // reassemble the hashtable byte of a hashvalue
+    uint8 operator[](uint64 h) {
+        uint8 m = 0;
+        for (int p=PLANES; p--;) {
+            m = (m<<1) | ((plane(p)[h/64]>>(h%64)) & 1);
         }
 
-        MoveIterator& operator++() {
-            while ((n<N && ++i<9 &&
-                    (i==4 ||
-                     (n%3==0 && i%3==0) ||
-                     (n%3==2 && i%3==2) ||
-                     (ANIMAL(grid[n-4+i]) &&
-                      !((grid[n]^grid[n-4+i]) & GOTE)) ||
-                     (ANIMAL(grid[n])==CHICK    && i!=7) ||
-                     (ANIMAL(grid[n])==HEN      && (i==0 || i==2)) ||
-                     (ANIMAL(grid[n])==ELEPHANT && (i&1)) ||
-                     (ANIMAL(grid[n])==GIRAFFE  && !(i&1)))) ||
-                   (n>=N && ++i<N && ANIMAL(grid[i]))) ;
+        return (m & 0x07) | ((m>>PLANE_DEPTH)<<3);
+    }
 
-            return *this;
+    // set the bits of a hashvalue, safe against concurrent updates of the word
+    void set(uint64 h, uint8 m) {
+        uint64 bit = 1ULL<<(h%64);
+        m = (m & 0x07) | ((m>>3)<<PLANE_DEPTH);
+        for (int p=0; p<PLANES; p++, m>>=1) {
+            if (m & 1) {
+                __atomic_fetch_or(&plane(p)[h/64], bit, __ATOMIC_RELAXED);
+            } else {
+                __atomic_fetch_and(&plane(p)[h/64], ~bit, __ATOMIC_RELAXED);
+            }
         }
-    };
+    }
 
-public:
-    // iterate over all pieces and moves
-    class PositionIterator {
-    private:
-        uint8* grid;
-        int sente;
-        PieceIterator piece;
-        MoveIterator move;
-        Board* board;
+    // split a range of the hashtable into the planes, a word at a time
+    void split(Hashtable& hashtable, uint64 start, uint64 stop) {
+        for (uint64 k=start/64; k<(stop+63)/64; k++) {
+            uint64 m = mask(k, start, stop);
+            uint64 w[PLANES] = { 0 };
+            for (int i=0; i<64; i++) {
+                if (m>>i & 1) {
+                    uint8 b = hashtable[64*k+i];
+                    b = (b & 0x07) | ((b>>3)<<PLANE_DEPTH);
+                    for (int p=0; b; p++, b>>=1) {
+                        w[p] |= (uint64) (b & 1)<<i;
+                    }
+                }
+            }
 
-    public:
-        PositionIterator(uint8* grid, int sente)
-            : grid(grid), sente(sente), piece(grid), board(NULL) {
+            for (int p=0; p<PLANES; p++) {
+                plane(p)[k] = (plane(p)[k] & ~m) | w[p];
+            }
         }
+    }
 
-        ~PositionIterator() {
-            if (board) {
-                delete board;
+    // count the hashvalues in [start, stop) with all bits of one plane set and
+    // none of another, e.g. LEGAL but neither WIN nor LOSS
+    uint64 count(uint64 start, uint64 stop, int set, int clear1=-1, int clear2=-1) {
+        uint64 n = 0;
+        for (uint64 k=start/64; k<(stop+63)/64; k++) {
+            uint64 w = plane(set)[k];
+            if (clear1>=0) {
+                w &= ~plane(clear1)[k];
             }
-        }
 
-        operator void*() {
-            if (!move) {
-                delete this;
-                return NULL;
+            if (clear2>=0) {
+                w &= ~plane(clear2)[k];
             }
 
-            return this;
+            n += __builtin_popcountll(w & mask(k, start, stop));
         }
 
-        PositionIterator& operator++() {
-            if (board) {
-                delete board;
-                board = NULL;
+        return n;
+    }
+
+    // ask the kernel to read ahead a range of one plane
+    void prefetch(int p, uint64 start, uint64 stop) {
+        uint64 page = sysconf(_SC_PAGESIZE);
+        uint64 a = ((uint64) (plane(p)+start/64)) & ~(page-1);
+        uint64 b = (uint64) (plane(p)+(stop+63)/64);
+        madvise((void*) a, b-a, MADV_WILLNEED);
+    }
+};
+
+// sample every 4096th legal position for select
+#define SAMPLE 4096
+
+// rank/select directory over the LEGAL bitmap of sente positions, maps a
+// sparse hashvalue to a dense index and back; gote positions are legal iff
+// the sente position is, so the orientation bit is dropped from the bitmap
+class Index {
+private:
+    static const uint64 magic = 0x5844495554424f44ULL;
+
+    uint64 bits;
+    uint64 words;
+    uint64 blocks;
+    uint64 bytes;
+    int fd;
+    uint64* map;
+
+    // header, LEGAL bitmap, two words per 512 bits for rank (absolute count
+    // and 9 bit counts relative to the block) and block numbers for select
+    uint64* bitmap;
+    uint64* dir;
+    uint64* sample;
+
+public:
+    Index(uint64 size, const char* indexname)
+        : bits(size/2), words((bits+63)/64), blocks((words+7)/8), fd(-1), map(NULL) {
+        bytes = (2+words+2*blocks+bits/SAMPLE+1)*sizeof(uint64);
+        if (indexname &&
+            (fd = open(indexname, O_CREAT | O_LARGEFILE | O_RDWR, 0664))>0 &&
+            ftruncate(fd, bytes)==0) {
+            map = (uint64*) mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+            if (map==MAP_FAILED) {
+                map = NULL;
+            }
+        }
+
+        bitmap = map+2;
+        dir = bitmap+words;
+        sample = dir+2*blocks;
+    }
+
+    ~Index() {
+        if (map) {
+            munmap(map, bytes);
+        }
+
+        if (fd>0) {
+            close(fd);
+        }
+    }
+
+    operator void*() {
+        return map;
+    }
+
+    // check if the directory has been built
+    int built() {
+        return map && map[0]==magic;
+    }
+
+    // number of legal positions, both orientations, 0 unless built
+    uint64 positions() {
+        return built() ? 2*map[1] : 0;
+    }
+
+    // number of directory blocks, 512 sente positions each
+    uint64 blockcount() {
+        return blocks;
+    }
+
+    // call f(i, h) for the legal sente positions h of a directory block with
+    // their dense index i, counted up from the block's rank
+    template<class F> void scan(uint64 block, const F& f) {
+        uint64 i = 2*dir[2*block];
+        for (uint64 w=8*block; w<8*block+8 && w<words; w++) {
+            for (uint64 m=bitmap[w]; m; m&=m-1) {
+                f(i, 2*(64*w+__builtin_ctzll(m)));
+                i += 2;
+            }
+        }
+    }
+
+    // build the bitmap and the directory from the LEGAL bits of the hashtable
+    void build(Hashtable& hashtable) {
+        uint64 ones = 0;
+        for (uint64 w=0; w<words; w++) {
+            if ((w & ((1<<15)-1))==0) {
+                // print progress every 1M positions
+                std::cout << std::setprecision(3) << 100.0*w/words << "%\r" << std::flush;
+            }
+
+            uint64 b = w/8;
+            if (w%8==0) {
+                dir[2*b] = ones;
+                dir[2*b+1] = 0;
+            } else {
+                dir[2*b+1] |= (ones-dir[2*b])<<(9*(w%8-1));
+            }
+
+            uint64 m = 0;
+            for (int i=0; i<64 && 64*w+i<bits; i++) {
+                if (hashtable[2*(64*w+i)] & LEGAL) {
+                    m |= 1ULL<<i;
+                }
+            }
+
+            bitmap[w] = m;
+
+            // remember the block of every SAMPLE-th legal position
+            uint64 n = ones+__builtin_popcountll(m);
+            for (uint64 k=(ones+SAMPLE-1)/SAMPLE; k*SAMPLE<n; k++) {
+                sample[k] = b;
+            }
+
+            ones = n;
+        }
+
+        map[1] = ones;
+        map[0] = magic;
+    }
+
+    // number of legal sente positions below position i of the bitmap
+    uint64 rank(uint64 i) {
+        uint64 w = i/64;
+        uint64 t = w%8;
+        uint64 r = dir[2*(w/8)];
+        if (t) {
+            r += (dir[2*(w/8)+1]>>(9*(t-1))) & 0x1ff;
+        }
+
+        return r+__builtin_popcountll(bitmap[w] & ((1ULL<<(i%64))-1));
+    }
+
+    // position of the j-th legal sente position in the bitmap
+    uint64 select(uint64 j) {
+        // binary search the blocks between two samples
+        uint64 lo = sample[j/SAMPLE];
+        uint64 hi = (j/SAMPLE+1)*SAMPLE<map[1] ? sample[j/SAMPLE+1]+1 : blocks;
+        while (hi-lo>1) {
+            uint64 mid = (lo+hi)/2;
+            if (dir[2*mid]<=j) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        // find the word within the block and the bit within the word
+        j -= dir[2*lo];
+        uint64 t = 0;
+        while (t<7 && 8*lo+t+1<words && ((dir[2*lo+1]>>(9*t)) & 0x1ff)<=j) {
+            t++;
+        }
+
+        if (t) {
+            j -= (dir[2*lo+1]>>(9*(t-1))) & 0x1ff;
+        }
+
+        uint64 m = bitmap[8*lo+t];
+        while (j--) {
+            m &= m-1;
+        }
+
+        return 64*(8*lo+t)+__builtin_ctzll(m);
+    }
+
+    // dense index of a hashvalue, ~0 for illegal positions
+    uint64 operator()(uint64 h) {
+        if (h>=2*bits || !(bitmap[h/128]>>(h/2%64) & 1)) {
+            return ~0ULL;
+        }
+
+        return 2*rank(h/2)+(h & 1);
+    }
+
+    // hashvalue of a dense index
+    uint64 operator[](uint64 i) {
+        return 2*select(i/2)+(i & 1);
+    }
+};
+
+// hashtable stored compactly, one byte per legal position in dense order;
+// chained as a read-only archive behind the hashtable
+class Dense : public Table {
+private:
+    Index& index;
+    uint64 size;
+    int fd;
+    uint8* map;
+
+protected:
+    uint8 get(uint64 h) {
+        return map ? (*this)[h] : ILLEGAL;
+    }
+
+    int holds(uint64 h) {
+        return map && index(h)<size;
+    }
+
+public:
+    // open an existing dense array read-only unless writable
+    Dense(Index& index, const char* densename, int writable=1)
+        : index(index), size(index.positions()), fd(-1), map(NULL) {
+        if (densename &&
+            (fd = open(densename, writable ? O_CREAT | O_LARGEFILE | O_RDWR : O_LARGEFILE | O_RDONLY, 0664))>0 &&
+            (writable ? ftruncate(fd, size)==0 : lseek(fd, 0, SEEK_END)==(off_t) size)) {
+            map = (uint8*) mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+            if (map==MAP_FAILED) {
+                map = NULL;
+            }
+        }
+    }
+
+    ~Dense() {
+        if (map) {
+            munmap(map, size);
+        }
+
+        if (fd>0) {
+            close(fd);
+        }
+    }
+
+    operator void*() {
+        return map;
+    }
+
+    // copy the legal positions of index blocks [first, last) of the
+    // hashtable in dense order
+    void fill(Hashtable& hashtable, uint64 first, uint64 last) {
+        for (uint64 b=first; b<last; b++) {
+            index.scan(b, [&](uint64 i, uint64 h) {
+                map[i] = hashtable[h];
+                map[i+1] = hashtable[h+1];
+            });
+        }
+    }
+
+    // look up a hashvalue, ILLEGAL if it has no dense index
+    uint8 operator[](uint64 h) {
+        uint64 i = index(h);
+        return i<size ? map[i] : ILLEGAL;
+    }
+};
+
+// output buffer, written in large chunks
+class Output {
+private:
+    char* buffer;
+    uint64 size;
+    uint64 used;
+
+public:
+    Output(uint64 size=1<<20)
+        : buffer((char*) malloc(size ? size : 1)), size(size ? size : 1), used(0) {
+    }
+
+    ~Output() {
+        free(buffer);
+    }
+
+    // make room for n more characters
+    char* reserve(uint64 n) {
+        if (used+n>size) {
+            while (used+n>size) {
+                size *= 2;
+            }
+
+            buffer = (char*) realloc(buffer, size);
+        }
+
+        return buffer+used;
+    }
+
+    // take the characters written up to p
+    void commit(char* p) {
+        used = p-buffer;
+    }
+
+    Output& operator<<(const char* s) {
+        uint64 n = strlen(s);
+        memcpy(reserve(n), s, n);
+        used += n;
+        return *this;
+    }
+
+    // append a hashvalue in hex
+    Output& hex(uint64 h) {
+        static const char digits[] = "0123456789abcdef";
+        char* p = reserve(20);
+        *p++ = '0';
+        *p++ = 'x';
+
+        int n = 1;
+        while (n<16 && h>>(4*n)) {
+            n++;
+        }
+
+        while (n--) {
+            *p++ = digits[(h>>(4*n)) & 0x0f];
+        }
+
+        commit(p);
+        return *this;
+    }
+
+    // write the buffer to a file descriptor and empty it
+    void flush(int fd=1) {
+        for (uint64 i=0; i<used;) {
+            ssize_t n = write(fd, buffer+i, used-i);
+            if (n<=0) {
+                break;
+            }
+
+            i += n;
+        }
+
+        used = 0;
+    }
+};
+
+// 8 byte record of a position: hashvalue (5 bytes, little endian), value
+// (1 win, -1 loss, 0 unresolved), search depth and best move from*N+to
+class Record {
+public:
+    enum { SIZE=8 };
+
+    static char* pack(char* p, uint64 h, uint8 m, int move) {
+        for (int i=0; i<5; i++) {
+            *p++ = h>>(8*i);
+        }
+
+        *p++ = m & WIN ? 1 : m & LOSS ? -1 : 0;
+        *p++ = (m>>3)*2;
+        *p++ = move;
+        return p;
+    }
+
+    static uint64 hash(const char* p) {
+        uint64 h = 0;
+        for (int i=5; i--;) {
+            h = (h<<8) | (uint8) p[i];
+        }
+
+        return h;
+    }
+
+    static int value(const char* p) {
+        return (signed char) p[5];
+    }
+
+    static int depth(const char* p) {
+        return (uint8) p[6];
+    }
+
+    static int move(const char* p) {
+        return (uint8) p[7];
+    }
+};
+
+// wait for another thread, yielding first and sleeping later
+static void backoff(int& spins) {
+    if (spins++<64) {
+        sched_yield();
+    } else {
+        usleep(100);
+    }
+}
+
+// threads sleeping until something changes: a thread takes a ticket before
+// it checks for the change, and a signal after the ticket wakes it even if
+// it comes before the thread is asleep
+class Event {
+private:
+    std::mutex lock;
+    std::condition_variable changed;
+    std::atomic<uint64> epoch;
+    std::atomic<int> waiting;
+
+public:
+    Event()
+        : epoch(0), waiting(0) {
+    }
+
+    uint64 ticket() {
+        return epoch;
+    }
+
+    // sleep until a signal after the ticket
+    void wait(uint64 ticket) {
+        std::unique_lock<std::mutex> guard(lock);
+        waiting++;
+        while (epoch==ticket) {
+            changed.wait(guard);
+        }
+
+        waiting--;
+    }
+
+    void signal() {
+        epoch++;
+        if (waiting>0) {
+            std::lock_guard<std::mutex> guard(lock);
+            changed.notify_all();
+        }
+    }
+};
+
+// tasks spawned in a group can be waited for and cancelled together
+class Group {
+private:
+    std::atomic<uint64> pending;
+    std::atomic<int> stopped;
+
+public:
+    // signalled when the last pending task is done
+    Event finished;
+
+    Group()
+        : pending(0), stopped(0) {
+    }
+
+    void add() {
+        pending++;
+    }
+
+    void done() {
+        if (--pending==0) {
+            finished.signal();
+        }
+    }
+
+    int busy() {
+        return pending>0;
+    }
+
+    // tasks of a cancelled group should return as soon as possible
+    void cancel() {
+        stopped = 1;
+    }
+
+    int cancelled() {
+        return stopped;
+    }
+};
+
+// unit of work for the thread pool
+class Task {
+public:
+    Group* group;
+
+    virtual ~Task() {
+    }
+
+    virtual void run() = 0;
+};
+
+// task running a function object
+template<class F> class Job : public Task {
+private:
+    F f;
+
+public:
+    Job(const F& f)
+        : f(f) {
+    }
+
+    void run() {
+        f();
+    }
+};
+
+// Chase-Lev deque of tasks: the owner pushes and pops at the bottom, other
+// workers steal from the top
+class Deque {
+private:
+    enum { CAPACITY=1<<12 };
+
+    std::atomic<int64> top;
+    std::atomic<int64> bottom;
+    std::atomic<Task*> tasks[CAPACITY];
+
+public:
+    Deque()
+        : top(0), bottom(0) {
+    }
+
+    int empty() {
+        return bottom.load(std::memory_order_relaxed)<=top.load(std::memory_order_relaxed);
+    }
+
+    // push a task, fails if the deque is full
+    int push(Task* task) {
+        int64 b = bottom.load(std::memory_order_relaxed);
+        if (b-top.load(std::memory_order_acquire)>=CAPACITY) {
+            return 0;
+        }
+
+        tasks[b%CAPACITY].store(task, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b+1, std::memory_order_relaxed);
+        return 1;
+    }
+
+    // pop the most recently pushed task
+    Task* pop() {
+        int64 b = bottom.load(std::memory_order_relaxed)-1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64 t = top.load(std::memory_order_relaxed);
+        if (t>b) {
+            bottom.store(b+1, std::memory_order_relaxed);
+            return NULL;
+        }
+
+        Task* task = tasks[b%CAPACITY].load(std::memory_order_relaxed);
+        if (t==b) {
+            // last task, race against thieves
+            if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                task = NULL;
+            }
+
+            bottom.store(b+1, std::memory_order_relaxed);
+        }
+
+        return task;
+    }
+
+    // steal the least recently pushed task
+    Task* steal() {
+        int64 t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64 b = bottom.load(std::memory_order_acquire);
+        if (t>=b) {
+            return NULL;
+        }
+
+        Task* task = tasks[t%CAPACITY].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return NULL;
+        }
+
+        return task;
+    }
+};
+
+// placement of the workers on the CPUs this process may run on, read from
+// the sysfs topology: physical cores are used before their SMT siblings, and
+// with numa the workers and the hashtable are split into one partition per
+// NUMA node
+class Topology {
+private:
+    struct Cpu {
+        int cpu;
+        int node;
+        int core;
+        int thread;
+
+        bool operator<(const Cpu& other) const {
+            return thread!=other.thread ? thread<other.thread :
+                node!=other.node ? node<other.node :
+                core!=other.core ? core<other.core : cpu<other.cpu;
+        }
+    };
+
+    int workers;
+    int smt;
+    int numa;
+    std::vector<Cpu> cpus;
+
+    // NUMA nodes of the partitions, and the CPUs of each partition
+    std::vector<int> nodes;
+    std::vector<std::vector<Cpu> > partitions;
+
+    // read a sysfs file, empty if it does not exist
+    static std::string read(const char* format, int n) {
+        char name[80];
+        snprintf(name, sizeof(name), format, n);
+        std::ifstream file(name);
+        std::string s;
+        std::getline(file, s);
+        return s;
+    }
+
+    // whether a CPU is in a list like "0-3,8-11", -1 if not, else the
+    // position of the CPU in the list
+    static int member(const std::string& list, int cpu) {
+        int position = 0;
+        for (const char* p=list.c_str(); *p;) {
+            char* end;
+            int first = strtol(p, &end, 10);
+            int last = *end=='-' ? strtol(end+1, &end, 10) : first;
+            if (end==p) {
+                break;
+            }
+
+            if (cpu>=first && cpu<=last) {
+                return position+cpu-first;
+            }
+
+            position += last-first+1;
+            p = *end ? end+1 : end;
+        }
+
+        return -1;
+    }
+
+public:
+    Topology(int workers, int smt=1, int numa=0)
+        : workers(workers<1 ? 1 : workers), smt(smt), numa(numa) {
+        std::vector<std::string> cpulists;
+        for (int node=0; node<64; node++) {
+            cpulists.push_back(read("/sys/devices/system/node/node%d/cpulist", node));
+        }
+
+        cpu_set_t allowed;
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                std::string core = read("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+                std::string package = read("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+                std::string siblings = read("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+                Cpu c = { cpu, 0, core.empty() ? cpu : (atoi(package.c_str())<<16) + atoi(core.c_str()), std::max(member(siblings, cpu), 0) };
+                for (int node=0; node<64; node++) {
+                    if (member(cpulists[node], cpu)>=0) {
+                        c.node = node;
+                    }
+                }
+
+                if (smt || c.thread==0) {
+                    cpus.push_back(c);
+                }
+            }
+        }
+
+        std::sort(cpus.begin(), cpus.end());
+        for (uint64 i=0; i<cpus.size(); i++) {
+            if (numa && std::find(nodes.begin(), nodes.end(), cpus[i].node)==nodes.end()) {
+                nodes.push_back(cpus[i].node);
+            }
+        }
+
+        if (nodes.empty()) {
+            // one partition with all CPUs
+            nodes.push_back(-1);
+        }
+
+        // no more partitions than workers
+        nodes.resize(min(nodes.size(), (uint64) this->workers));
+        partitions.resize(nodes.size());
+        for (uint64 i=0; i<cpus.size(); i++) {
+            for (uint64 p=0; p<nodes.size(); p++) {
+                if (nodes[p]<0 || nodes[p]==cpus[i].node) {
+                    partitions[p].push_back(cpus[i]);
+                }
+            }
+        }
+    }
+
+    int size() {
+        return nodes.size();
+    }
+
+    // partition of worker i, the workers of a partition are consecutive
+    int home(int i) {
+        return (uint64) i*nodes.size()/workers;
+    }
+
+    // partition of the hashtable holding a hashvalue
+    int partition(uint64 h) {
+        return h<S ? h*nodes.size()/S : 0;
+    }
+
+    // CPU of worker i, cores before their siblings within its partition
+    int cpu(int i) {
+        std::vector<Cpu>& p = partitions[home(i)];
+        int first = 0;
+        while (home(first)!=home(i)) {
+            first++;
+        }
+
+        return p.empty() ? -1 : p[(i-first)%p.size()].cpu;
+    }
+
+    // move the pages of each partition of a hashtable to its NUMA node; this
+    // only takes effect for memory that is not backed by a file
+    void bind(uint8* map, uint64 size) {
+        uint64 page = sysconf(_SC_PAGESIZE);
+        for (uint64 p=0; map && numa && p<nodes.size(); p++) {
+            uint64 first = (size*p/nodes.size()) & ~(page-1);
+            uint64 last = p+1<nodes.size() ? (size*(p+1)/nodes.size()) & ~(page-1) : size;
+            unsigned long mask[2] = { 0, 0 };
+            mask[nodes[p]/64] |= 1UL<<(nodes[p]%64);
+            if (syscall(SYS_mbind, map+first, last-first, MPOL_BIND, mask, 128, MPOL_MF_MOVE)) {
+                std::cerr << "cannot bind partition " << p << " to node " << nodes[p] << std::endl;
+            }
+        }
+    }
+
+    // report the placement of the workers
+    void print(std::ostream& out, int pin) {
+        out << workers << " workers";
+        if (pin) {
+            out << " pinned to cpu";
+            for (int i=0; i<workers; i++) {
+                out << (i ? "," : " ") << cpu(i);
+            }
+
+            if (numa) {
+                out << ", node";
+                for (int i=0; i<workers; i++) {
+                    out << (i ? "," : " ") << nodes[home(i)];
+                }
+            }
+
+            out << (smt ? ", smt siblings used" : ", no smt siblings");
+        } else {
+            out << " on " << cpus.size() << " cpus, not pinned";
+        }
+
+        out << std::endl;
+    }
+};
+
+// work-stealing thread pool, one deque per worker, tasks spawned by other
+// threads go to a shared queue
+class Pool {
+private:
+    static thread_local int current;
+
+    int workers;
+    Topology* topology;
+    Deque* deques;
+    std::thread** threads;
+    std::atomic<int> stopping;
+    std::mutex lock;
+    std::vector<std::deque<Task*> > injected;
+    std::atomic<int> queued;
+
+    // signalled for every task submitted, idle workers sleep on it
+    Event work;
+
+    void execute(Task* task) {
+        Group* group = task->group;
+        task->run();
+        delete task;
+        group->done();
+    }
+
+    // find a task: own deque first, then the shared queue, then steal
+    Task* find(int id, uint32& seed) {
+        Task* task = id>=0 ? deques[id].pop() : NULL;
+        if (!task && queued>0) {
+            // tasks of the worker's own partition first
+            std::lock_guard<std::mutex> guard(lock);
+            int home = id>=0 && topology ? topology->home(id) : 0;
+            for (uint64 i=0; !task && i<injected.size(); i++) {
+                std::deque<Task*>& queue = injected[(home+i)%injected.size()];
+                if (!queue.empty()) {
+                    task = queue.front();
+                    queue.pop_front();
+                    queued--;
+                }
+            }
+        }
+
+        for (int i=0; !task && i<workers; i++) {
+            seed ^= seed<<13;
+            seed ^= seed>>17;
+            seed ^= seed<<5;
+            int victim = seed%workers;
+            if (victim!=id) {
+                task = deques[victim].steal();
+            }
+        }
+
+        return task;
+    }
+
+    void loop(int id) {
+        current = id;
+        if (topology && topology->cpu(id)>=0) {
+            // pin worker i to its CPU
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(topology->cpu(id), &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        uint32 seed = 2654435761U*(id+1);
+        for (int spins=0; !stopping;) {
+            uint64 ticket = work.ticket();
+            Task* task = find(id, seed);
+            if (task) {
+                execute(task);
+                spins = 0;
+            } else if (spins++<64) {
+                sched_yield();
+            } else {
+                // park until a task is submitted
+                work.wait(ticket);
+            }
+        }
+    }
+
+public:
+    Pool(int workers, Topology* topology=NULL)
+        : workers(workers<1 ? 1 : workers), topology(topology), stopping(0),
+          injected(topology ? topology->size() : 1), queued(0) {
+        deques = new Deque[this->workers];
+        threads = new std::thread*[this->workers];
+        for (int i=0; i<this->workers; i++) {
+            threads[i] = new std::thread(&Pool::loop, this, i);
+        }
+    }
+
+    ~Pool() {
+        stopping = 1;
+        work.signal();
+        for (int i=0; i<workers; i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+
+        delete[] threads;
+        delete[] deques;
+    }
+
+    int size() {
+        return workers;
+    }
+
+    // index of the calling worker, -1 for other threads
+    static int self() {
+        return current;
+    }
+
+    // partition of the hashtable holding a hashvalue
+    int home(uint64 h) {
+        return topology ? topology->partition(h) : 0;
+    }
+
+    // submit a task in a group, tasks from other threads are queued for the
+    // workers of a partition
+    void submit(Group& group, Task* task, int home=0) {
+        task->group = &group;
+        group.add();
+        if (current>=0 && deques[current].push(task)) {
+            work.signal();
+            return;
+        }
+
+        if (current>=0) {
+            // own deque is full, run the task right away
+            execute(task);
+        } else {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                injected[home%injected.size()].push_back(task);
+                queued++;
+            }
+
+            work.signal();
+        }
+    }
+
+    // spawn a function object as a task in a group
+    template<class F> void spawn(Group& group, const F& f, int home=0) {
+        submit(group, new Job<F>(f), home);
+    }
+
+    // wait for all tasks of a group, workers help with other tasks meanwhile,
+    // other threads sleep until the group is finished
+    void wait(Group& group) {
+        uint32 seed = 2654435761U*(current+2);
+        for (int spins=0;;) {
+            uint64 ticket = group.finished.ticket();
+            if (!group.busy()) {
+                break;
+            }
+
+            Task* task = current>=0 ? find(current, seed) : NULL;
+            if (task) {
+                execute(task);
+                spins = 0;
+            } else if (current>=0) {
+                backoff(spins);
+            } else {
+                group.finished.wait(ticket);
+            }
+        }
+    }
+
+    // call body(a, b) for consecutive chunks of [start, stop) of at least
+    // grain hashvalues; a range is split in half whenever the worker running
+    // it has nothing left to be stolen, so chunks adapt to the load
+    template<class F> void parallel_for(uint64 start, uint64 stop, uint64 grain, const F& body, Group* group=NULL) {
+        Group own;
+        Group& g = group ? *group : own;
+        submit(g, new Range<F>(*this, start, stop, grain ? grain : 1, body));
+        wait(g);
+    }
+
+private:
+    template<class F> class Range : public Task {
+    private:
+        Pool& pool;
+        uint64 start;
+        uint64 stop;
+        uint64 grain;
+        F body;
+
+    public:
+        Range(Pool& pool, uint64 start, uint64 stop, uint64 grain, const F& body)
+            : pool(pool), start(start), stop(stop), grain(grain), body(body) {
+        }
+
+        void run() {
+            while (start<stop && !group->cancelled()) {
+                if (stop-start>=2*grain && pool.workers>1 && current>=0 && pool.deques[current].empty()) {
+                    uint64 mid = start+(stop-start)/2;
+                    pool.submit(*group, new Range(pool, mid, stop, grain, body));
+                    stop = mid;
+                }
+
+                uint64 end = min(start+grain, stop);
+                body(start, end);
+                start = end;
+            }
+        }
+    };
+};
+
+thread_local int Pool::current = -1;
+
+// limits of an anytime search: a node budget and a wall-clock deadline,
+// either 0 for none, polled every 1024 nodes
+class Limit {
+private:
+    uint64 budget;
+    int64 deadline;
+    uint64 start;
+
+public:
+    int stopped;
+
+    // microseconds since the epoch
+    static int64 now() {
+        struct timeval t;
+        gettimeofday(&t, NULL);
+        return (int64) t.tv_sec*1000000+t.tv_usec;
+    }
+
+    Limit(uint64 budget=0, int64 millis=0, uint64 nodes=0)
+        : budget(budget), deadline(millis ? now()+1000*millis : 0), start(nodes), stopped(0) {
+    }
+
+    // check the limits after a number of nodes of the calling thread
+    int poll(uint64 nodes) {
+        if ((nodes & 1023)==0 &&
+            ((budget && nodes-start>=budget) || (deadline && now()>=deadline))) {
+            stopped = 1;
+        }
+
+        return stopped;
+    }
+};
+
+class Board {
+private:
+    // lookup tables
+    static uint8 lionPosition[2*L];
+    static uint8 lionGrid[N][N];
+    static uint8 animal[4];
+    static char picture[2][5+(W+4)*H];
+    static uint16 reach[2][16][N];
+
+    // pieces on the board and on hand
+    uint8 grid[N+D];
+    int sente;
+    int illegal;
+    int result;
+
+    // iterate over a grid to find all pieces
+    class PieceIterator {
+    private:
+        uint8* grid;
+        uint32 i;
+
+    public:
+        PieceIterator(uint8* grid)
+            : grid(grid), i(~0) {
+        }
+
+        operator void*() const {
+            return i<N+D ? (void*) this : NULL;
+        }
+
+        uint32 operator()() const {
+            return i;
+        }
+
+        uint8* operator&() const {
+            return grid;
+        }
+
+        PieceIterator& operator++() {
+            while (++i<N+D && (!ANIMAL(grid[i]) || !SENTE(grid[i]) || (i>N && ANIMAL(grid[i])==ANIMAL(grid[i-1])))) ;
+            return *this;
+        }
+    };
+
+    // iterate around a piece to find all possible moves
+    class MoveIterator {
+    private:
+        uint8* grid;
+        uint32 n;
+        uint32 i;
+
+    public:
+        MoveIterator()
+            : grid(NULL), n(N), i(N) {
+        }
+
+        MoveIterator& operator=(const MoveIterator& m) {
+            grid = m.grid;
+            n = m.n;
+            i = m.i;
+            return *this;
+        }
+
+        MoveIterator& reset(const PieceIterator& p) {
+            grid = &p;
+            n = p();
+            i = p()<N ? p()<4 ? 4-p()-1 : ~0 : ~0;
+            return *this;
+        }
+
+        MoveIterator(const PieceIterator& p) {
+            reset(p);
+        }
+
+        operator void*() const {
+            return
+                n<N ? i<9 && n-4+i<N ? (void*) this : NULL :
+                i<N ? (void*) this : NULL;
+        }
+
+        int operator==(uint32 l) {
+            return n<N ? n-4+i==l : i==l;
+        }
+
+        uint32 from() const {
+            return n;
+        }
+
+        uint32 to() const {
+            return n<N ? n-4+i : i;
+        }
+
+        MoveIterator& operator++() {
+            while ((n<N && ++i<9 &&
+                    (i==4 ||
+                     (n%3==0 && i%3==0) ||
+                     (n%3==2 && i%3==2) ||
+                     (ANIMAL(grid[n-4+i]) &&
+                      !((grid[n]^grid[n-4+i]) & GOTE)) ||
+                     (ANIMAL(grid[n])==CHICK    && i!=7) ||
+                     (ANIMAL(grid[n])==HEN      && (i==0 || i==2)) ||
+                     (ANIMAL(grid[n])==ELEPHANT && (i&1)) ||
+                     (ANIMAL(grid[n])==GIRAFFE  && !(i&1)))) ||
+                   (n>=N && ++i<N && ANIMAL(grid[i]))) ;
+
+            return *this;
+        }
+    };
+
+public:
+    // iterate over all pieces and moves
+    class PositionIterator {
+    private:
+        uint8* grid;
+        int sente;
+        PieceIterator piece;
+        MoveIterator move;
+        Board* board;
+
+    public:
+        PositionIterator(uint8* grid, int sente)
+            : grid(grid), sente(sente), piece(grid), board(NULL) {
+        }
+
+        ~PositionIterator() {
+            if (board) {
+                delete board;
+            }
+        }
+
+        operator void*() {
+            if (!move) {
+                delete this;
+                return NULL;
+            }
+
+            return this;
+        }
+
+        PositionIterator& operator++() {
+            if (board) {
+                delete board;
+                board = NULL;
+            }
+
+            while (!++move && ++piece) {
+                move.reset(piece);
+            }
+
+            return *this;
+        }
+
+        Board& operator()() {
+            if (!board) {
+                board = new Board(grid, sente, move);
+            }
+
+            return *board;
+        }
+
+        const PieceIterator& getPiece() const {
+            return piece;
+        }
+
+        const MoveIterator& getMove() const {
+            return move;
+        }
+};
+
+public:
+    // initialize lookup tables
+    static void initialize() {
+        memset(lionGrid, ~0, sizeof(lionGrid));
+        for (int i=0; i<L; i++) {
+            lionGrid[lionPosition[2*i]][lionPosition[2*i+1]] = i;
+        }
+
+        // squares attacked by each piece, gote pieces move towards rank 1
+        for (int g=0; g<2; g++) {
+            for (int n=0; n<N; n++) {
+                for (int i=0; i<9; i++) {
+                    int j = g ? 8-i : i;
+                    if (i==4 || n-4+i<0 || n-4+i>=N || (n%3==0 && i%3==0) || (n%3==2 && i%3==2)) {
+                        continue;
+                    }
+
+                    reach[g][LION][n] |= 1<<(n-4+i);
+                    reach[g][GIRAFFE][n] |= (j&1)<<(n-4+i);
+                    reach[g][ELEPHANT][n] |= !(j&1)<<(n-4+i);
+                    reach[g][HEN][n] |= (j!=0 && j!=2)<<(n-4+i);
+                    reach[g][CHICK][n] |= (j==7)<<(n-4+i);
+                }
+            }
+        }
+
+        // empty boards with coordinates as printed for gote and sente
+        for (int s=0; s<2; s++) {
+            memcpy(picture[s], s ? " 321\n" : " 123\n", 5);
+            for (int y=H; y--;) {
+                char* p = picture[s]+5+(W+4)*(H-1-y);
+                memset(p, EMPTY, W+4);
+                p[0] = p[W+1] = '|';
+                p[W+2] = '0'+(s ? H-y : y+1);
+                p[W+3] = '\n';
+            }
+        }
+    }
+
+private:
+    // determine the order of pieces on hand
+    static int reorder(uint8 p, uint8 q) {
+        return !ANIMAL(p) || (ANIMAL(q) && ANIMAL(p)<ANIMAL(q));
+    }
+
+    // find a piece on the board
+    int find(uint8 p, int start=0, int end=N) {
+        for (int i=start; i<end; i++) {
+            if (grid[i]==p) {
+                return i;
+            }
+        }
+
+        return end;
+    }
+
+    // square of a grid as seen by the other side
+    static uint8 mirror(const uint8* g, int i) {
+        uint8 p = g[i<N ? N-1-i : i];
+        return ANIMAL(p) ? p ^ GOTE : p;
+    }
+
+    // square of the grid as seen by sente, side tells statically whether
+    // the grid is stored as seen by sente or flipped for gote
+    template<int side> uint8 square(int i) const {
+        return side ? grid[i] : mirror(grid, i);
+    }
+
+    // flip the board for gote
+    void flip() {
+        if (!sente) {
+            uint8 g[N];
+            for (int i=0; i<N; i++) {
+                g[i] = grid[N-1-i];
+            }
+
+            memcpy(grid, g, N);
+
+            for (int i=0; i<N+D; i++) {
+                if (ANIMAL(grid[i])) {
+                    FLIP(grid[i]);
+                }
+            }
+        }
+    }
+
+    // hashvalues of the positions on the search path of the calling thread,
+    // and the lowest index on the path a repetition below the current node
+    // went back to
+    static thread_local uint64 path[PATH];
+    static thread_local int plies;
+    static thread_local int repeated;
+
+    // whether a hashvalue repeats a position on the path with the same side
+    // to move
+    static int repetition(uint64 h) {
+        for (int i=plies-2; i>=0; i-=2) {
+            if (i<PATH && path[i]==h) {
+                repeated = min(repeated, i);
+                repetitions++;
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // calculate the hashvalue of a legal board with sente or gote to move,
+    // reading the squares through the orientation of the grid instead of
+    // flipping it
+    template<int side> uint64 hash() {
+        int l = N;
+        int n = N;
+        for (int i=0; i<N; i++) {
+            if (square<side>(i)==PIECE_SENTE(LION)) {
+                l = i;
+            } else if (square<side>(i)==PIECE_GOTE(LION)) {
+                n = i;
+            }
+        }
+
+        if (l>=N || n>=N || lionGrid[l][n]>L) {
+            return ~0;
+        }
+
+        uint64 h = lionGrid[l][n];
+
+        // promote chicks
+        for (int i=N+D; i--;) {
+            uint8 p = square<side>(i);
+            if (ANIMAL(p)==CHICK || ANIMAL(p)==HEN) {
+                h <<= 1;
+                if (ANIMAL(p)==HEN) {
+                    h |= 0x01;
+                }
+            }
+        }
+
+        // sort pieces on hand, the order doesn't depend on the side
+        for (int i=N; i<N+D-1; i++) {
+            for (int j=i+1; j<N+D; j++) {
+                if (reorder(grid[i], grid[j])) {
+                    uint8 swap = grid[i];
+                    grid[i] = grid[j];
+                    grid[j] = swap;
+                }
+            }
+        }
+
+        // assign pieces to sente/gote
+        for (int i=N+D; i--;) {
+            uint8 p = square<side>(i);
+            if (ANIMAL(p) && ANIMAL(p)!=LION) {
+                h <<= 1;
+                if (p & GOTE) {
+                    h |= 0x01;
+                }
+            }
+        }
+
+        // encode the pieces on the remaining 10 fields
+        for (int i=N; i--;) {
+            uint8 p = square<side>(i);
+            if (ANIMAL(p)!=LION) {
+                h <<=2;
+                if (ANIMAL(p)) {
+                    h |= (ANIMAL(p)-CHICK)/2+1;
+                }
+            }
+        }
+
+        // board orientation
+        h <<= 1;
+        if (!side) {
+            h |= 1;
+        }
+
+        return h;
+    }
+
+public:
+    // nodes expanded by the searches of the calling thread
+    static thread_local uint64 nodes;
+
+    // limits of the anytime search of the calling thread, NULL for none
+    static thread_local Limit* limit;
+
+    // first of the chain of tables the searches consult
+    static Table* table;
+
+    // positions scored as draws by repetition
+    static std::atomic<uint64> repetitions;
+
+    // whether leaves score by the static evaluation, otherwise as draws so
+    // the searches only stop short of proofs at proven results
+    static int evaluating;
+
+    // construct a board from a position string
+    Board(const char* s="ELG C  c gle      ", int sente=1)
+        : sente(sente), illegal(0), result(0) {
+        memset(grid, EMPTY, sizeof(grid));
+        memcpy(grid, s, min(sizeof(grid), strlen(s)));
+    }
+
+    // construct a board from a grid and a move to execute, the grid of the
+    // child is written flipped for the other side in one pass and the move
+    // applied in flipped coordinates
+    Board(uint8* g, int s, const MoveIterator& move) : sente(!s), illegal(0), result(0) {
+        for (int i=0; i<N+D; i++) {
+            grid[i] = mirror(g, i);
+        }
+
+        int from = move.from()<N ? N-1-move.from() : move.from();
+        int to = N-1-move.to();
+        if (ANIMAL(grid[to])) {
+            if (ANIMAL(grid[to])==LION) {
+                // losing the lions loses the game
+                result = -9999;
+            }
+
+            grid[find(EMPTY, N, N+D)] = FLIP(grid[to]);
+        }
+
+        grid[to] = grid[from];
+        grid[from] = EMPTY;
+
+        if (to<W && ANIMAL(grid[to])==CHICK) {
+            // promote chick
+            PROMOTE(grid[to]);
+        }
+
+        for (int i=N-W; i<N; i++) {
+            if (SENTE(grid[i]) && ANIMAL(grid[i])==LION) {
+                // a lion surving on final rank wins
+                result = 9999;
+                break;
+            }
+        }
+    }
+
+    // construct a board from a hashvalue
+    Board(uint64 h)
+        : sente(0), illegal(h>=S), result(0) {
+        memset(grid, EMPTY, sizeof(grid));
+        if (illegal) {
+            return;
+        }
+
+        // decode the position of both lions
+        grid[lionPosition[2*(h>>29)]] = PIECE_SENTE(LION);
+        grid[lionPosition[2*(h>>29)+1]] = PIECE_GOTE(LION);
+
+        // board orientation
+        sente = h & 0x01 ? 0 : 1;
+        h >>= 1;
+
+        // decode the pieces on the remaining 10 fields
+        uint32 count[4] = { 0 };
+        for (int i=0; i<N && h; i++) {
+            if (!ANIMAL(grid[i])) {
+                if (h & 0x03) {
+                    grid[i] = animal[h & 0x03];
+                    if (++count[h & 0x03]>2) {
+                        illegal++;
+                        return;
+                    }
+                }
+
+                h >>= 2;
+            }
+        }
+
+        // add the remaining pieces to be dropped
+        int a = 3;
+        for (int i=N; i<N+D; i++) {
+            while (a && count[a]>=2) {
+                a--;
+            }
+
+            grid[i] = animal[a];
+            count[a]++;
+        }
+
+        // assign pieces to sente/gote
+        for (int i=0; i<N+D; i++) {
+            if (ANIMAL(grid[i]) && ANIMAL(grid[i])!=LION) {
+                if (h & 0x01) {
+                    grid[i] |= GOTE;
+                }
+
+                h >>= 1;
+            }
+        }
+
+        // promote chicks
+        for (int i=0; i<N+D; i++) {
+            if (ANIMAL(grid[i])==CHICK) {
+                if (h & 0x01) {
+                    if (i<N) {
+                        PROMOTE(grid[i]);
+                    } else {
+                        // chicks to drop can't be promoted
+                        illegal++;
+                        return;
+                    }
+                }
+
+                h >>= 1;
+            }
+        }
+
+        flip();
+    }
+
+    // check if the board position is legal
+    operator void*() {
+        return illegal ? NULL : this;
+    }
+
+    // calculate a hashvalue for the board
+    uint64 operator()() {
+        if (!illegal) {
+            return sente ? hash<1>() : hash<0>();
+        }
+
+        return ~0;
+    }
+
+    // print the board
+    void print(const MoveIterator& move = MoveIterator()) {
+        if (!illegal) {
+            std::cout << (sente ? " 321" : " 123") << std::endl;
+            for (int y=H; y--;) {
+                std::cout << "|";
+                for (int x=0; x<W; x++) {
+                    std::cout << grid[y*W+x];
+                }
+                std::cout << "|" << (sente ? H-y : y+1) << std::endl;
+            }
+
+            int a = 0;
+            for (int i=N; i<N+D; i++) {
+                if (ANIMAL(grid[i])) {
+                    std::cout << grid[i];
+                    a++;
+                }
+            }
+
+            if (a) {
+                std::cout << std::endl;
+            }
+
+            if (move) {
+                if (sente) {
+                    std::cout << W-(N-1-move.from())%W << (N-1-move.from())/W+1 << "->" << W-(N-1-move.to())%W << (N-1-move.to())/W+1 << " wins" << std::endl << std::endl;
+                } else {
+                    std::cout << move.from()%W+1 << move.from()/W+1 << "->" << move.to()%W+1 << move.to()/W+1 << " wins" << std::endl << std::endl;
+                }
+            }
+
+            if (result) {
+                std::cout << (result>0 ? " is won #" : " is lost #") << result << std::endl;
+            }
+        }
+    }
+
+    // square of the sente or gote lion of a lion pair
+    static int lion(int pair, int gote) {
+        return lionPosition[2*pair+gote];
+    }
+
+    // count the pieces on hand of the side to move and of the opponent
+    void material(int* own, int* other) {
+        for (int i=N; i<N+D; i++) {
+            if (ANIMAL(grid[i])) {
+                (*(SENTE(grid[i]) ? own : other))++;
+            }
+        }
+    }
+
+    // cheap static estimate of how close a position is to its end: 3 if the
+    // other lion can be captured, 2 if a lion is at most one rank away from
+    // its final rank, 1 if another piece can be captured, 0 otherwise
+    int urgency() {
+        int score = 0;
+        for (PieceIterator piece(grid); ++piece && piece()<N;) {
+            for (MoveIterator move(piece); ++move;) {
+                if (ANIMAL(grid[move.to()])) {
+                    if (ANIMAL(grid[move.to()])==LION) {
+                        return 3;
+                    }
+
+                    score = 1;
+                }
+            }
+        }
+
+        return find(PIECE_SENTE(LION))>=N-2*W || find(PIECE_GOTE(LION))<2*W ? 2 : score;
+    }
+
+    // write a move from*N+to in the notation of print(), drops as "C*22"
+    char* notation(char* p, int move) {
+        int from = move/N;
+        int to = move%N;
+        if (from>=N) {
+            *p++ = PIECE_SENTE(ANIMAL(grid[from]));
+            *p++ = '*';
+        } else {
+            *p++ = '0'+(sente ? W-(N-1-from)%W : from%W+1);
+            *p++ = '0'+(sente ? (N-1-from)/W+1 : from/W+1);
+            *p++ = '-';
+            *p++ = '>';
+        }
+
+        *p++ = '0'+(sente ? W-(N-1-to)%W : to%W+1);
+        *p++ = '0'+(sente ? (N-1-to)/W+1 : to/W+1);
+        *p = 0;
+        return p;
+    }
+
+    // render the board like print() into a buffer, or compactly on one line
+    void format(Output& out, uint64 h, int compact) {
+        out.hex(h);
+        char* p = out.reserve(sizeof(picture[0])+N+D+8);
+        if (compact) {
+            *p++ = ' ';
+            for (int y=H; y--;) {
+                memcpy(p, grid+y*W, W);
+                p += W;
+                *p++ = y ? '/' : ' ';
+            }
+        } else {
+            *p++ = '\n';
+            memcpy(p, picture[sente], sizeof(picture[0]));
+            for (int y=H; y--;) {
+                memcpy(p+5+(W+4)*(H-1-y)+1, grid+y*W, W);
+            }
+
+            p += sizeof(picture[0]);
+        }
+
+        int a = 0;
+        for (int i=N; i<N+D; i++) {
+            if (ANIMAL(grid[i])) {
+                *p++ = grid[i];
+                a++;
+            }
+        }
+
+        if (compact) {
+            if (!a) {
+                *p++ = '-';
+            }
+        } else if (a) {
+            *p++ = '\n';
+        }
+
+        *p++ = '\n';
+        out.commit(p);
+    }
+
+    // generate moves
+    PositionIterator& children() {
+        return *new PositionIterator(grid, sente);
+    }
+
+    // resolve a position from the results of its children in the bit planes,
+    // won if a child is lost, lost if all children are won, 0 if unknown
+    int retrograde(Bitplanes& planes) {
+        int won = 1;
+        for (PositionIterator& child=children(); ++child;) {
+            Board& c = child();
+            uint64 h = c.result ? ~0ULL : c();
+            int decided = !c.result && h==~0ULL ? c.decided() : 0;
+            if (c.result<0 || decided<0 || (h<S && planes.test(Bitplanes::PLANE_LOSS, h))) {
+                delete &child;
+                return 1;
+            }
+
+            won &= c.result>0 || decided>0 || (h<S && planes.test(Bitplanes::PLANE_WIN, h));
+        }
+
+        return won ? -1 : 0;
+    }
+
+    // find the best move from the table: capture the lion or move to a lost
+    // position, preferring the shallowest loss, otherwise avoid moving to a
+    // won position, preferring the deepest win; returns from*N+to or NOMOVE
+    int best(int* value=NULL) {
+        int move = NOMOVE;
+        int score = -99999;
+        for (PositionIterator& child=children(); ++child;) {
+            Board& c = child();
+            int rc = 0;
+            if (c.result) {
+                rc = -c.result;
+            } else {
+                uint8 m = table->probe(c());
+                if (m & LOSS) {
+                    rc = 9999-(m>>3);
+                } else if (m & WIN) {
+                    rc = -9999+(m>>3);
+                }
+            }
+
+            if (rc>score) {
+                score = rc;
+                move = child.getMove().from()*N+child.getMove().to();
+            }
+        }
+
+        if (value) {
+            *value = score;
+        }
+
+        return move;
+    }
+
+    // the position after a move from*N+to, illegal if the move is impossible
+    Board after(int move) {
+        Board b(*this);
+        b.illegal = 1;
+        for (PositionIterator& child=children(); ++child;) {
+            if ((int) (child.getMove().from()*N+child.getMove().to())==move) {
+                b = child();
+                delete &child;
+                break;
+            }
+        }
+
+        return b;
+    }
+
+    // result of the last move, 9999 if the side to move has won, -9999 if lost
+    int terminal() {
+        return result;
+    }
+
+    // value of the position for the side to move from its result or the
+    // table: 1 won, -1 lost, 0 unresolved
+    int value() {
+        if (result) {
+            return result>0 ? 1 : -1;
+        }
+
+        uint8 m = table->probe((*this)());
+        return m & WIN ? 1 : m & LOSS ? -1 : 0;
+    }
+
+    // find a move given in the notation of print(), NOMOVE if there is none
+    int parse(const char* s) {
+        for (PositionIterator& child=children(); ++child;) {
+            char t[8];
+            int move = child.getMove().from()*N+child.getMove().to();
+            notation(t, move);
+            if (!strcmp(s, t)) {
+                delete &child;
+                return move;
+            }
+        }
+
+        return NOMOVE;
+    }
+
+    // print the principal variation from the table, following the best moves
+    // while the position is resolved, up to a number of plies
+    void variation(int plies) {
+        Board b(*this);
+        for (int ply=0; ply<plies && !b.result; ply++) {
+            uint64 h = b();
+            if (!(table->probe(h) & (WIN | LOSS))) {
+                break;
+            }
+
+            int move = b.best();
+            if (move==NOMOVE) {
+                break;
+            }
+
+            char s[8];
+            b.notation(s, move);
+            std::cout << " " << s;
+            b = b.after(move);
+        }
+    }
+
+    // squares attacked by the side to move and by the other side, and the
+    // squares of both lions
+    void attacks(uint16& attacking, uint16& attacked, int& lion, int& other) {
+        attacking = attacked = 0;
+        lion = other = 0;
+        for (int i=0; i<N; i++) {
+            if (ANIMAL(grid[i])) {
+                if (SENTE(grid[i])) {
+                    attacking |= reach[0][ANIMAL(grid[i])][i];
+                } else {
+                    attacked |= reach[1][ANIMAL(grid[i])][i];
+                }
+
+                if (ANIMAL(grid[i])==LION) {
+                    *(SENTE(grid[i]) ? &lion : &other) = i;
+                }
+            }
+        }
+    }
+
+    // static evaluation for the side to move from material, the advancement
+    // of the lions towards their final rank and their safety
+    int evaluate() {
+        // values of chicks, hens, elephants and giraffes on the board and on
+        // hand, a captured hen turns into a chick
+        static const int board[16] = { 0, 0, 0, 10, 35, 30, 0, 35 };
+        static const int hand[16] = { 0, 0, 0, 12, 12, 33, 0, 38 };
+
+        int score = 0;
+        for (int i=0; i<N+D; i++) {
+            if (ANIMAL(grid[i])) {
+                int value = i<N ? board[ANIMAL(grid[i])] : hand[ANIMAL(grid[i])];
+                score += SENTE(grid[i]) ? value : -value;
+            }
+        }
+
+        uint16 attacking;
+        uint16 attacked;
+        int lion;
+        int other;
+        attacks(attacking, attacked, lion, other);
+        if (attacking>>other & 1) {
+            // the other lion can be captured
+            return PROVEN-1;
+        }
+
+        // lions closer to their final rank
+        score += 8*(lion/W)-8*((N-1-other)/W);
+
+        // a lion in check, and squares around the lions under attack
+        if (attacked>>lion & 1) {
+            score -= 50;
+        }
+
+        score -= 4*__builtin_popcount(reach[0][LION][lion] & attacked);
+        score += 4*__builtin_popcount(reach[1][LION][other] & attacking);
+        return score<-(PROVEN-1) ? -(PROVEN-1) : score>PROVEN-1 ? PROVEN-1 : score;
+    }
+
+    // result of a position without a hashvalue, with the lions adjacent or
+    // the other lion on its final rank: won if the other lion can be
+    // captured, lost otherwise
+    int decided() {
+        uint16 attacking;
+        uint16 attacked;
+        int lion;
+        int other;
+        attacks(attacking, attacked, lion, other);
+        return attacking>>other & 1 ? 1 : -1;
+    }
+
+    // whether the side to move faces a threat: its lion can be captured, or
+    // the other lion stands on its final rank out of reach
+    int threatened() {
+        uint16 attacking;
+        uint16 attacked;
+        int lion;
+        int other;
+        attacks(attacking, attacked, lion, other);
+        return (attacked>>lion & 1) || (other<W && !(attacking>>other & 1));
+    }
+
+    // whether the side to move forces a win within depth plies by threats to
+    // the other lion and safe tries only; proven wins are entered into the
+    // table
+    int hunt(int depth) {
+        if (result) {
+            return result>0;
+        }
+
+        uint64 h = (*this)();
+        uint8 m = table->probe(h);
+        if (m & (WIN | LOSS) || depth<1) {
+            return (m & WIN)!=0;
+        }
+
+        nodes++;
+        for (PositionIterator& child=children(); ++child;) {
+            Board& c = child();
+            if (c.result<0 || (!c.result && depth>2 && c.threatened() && c.evade(depth-1))) {
+                delete &child;
+                table->enter(h, depth, 9999);
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // whether all replies of the side to move to a threat lose within depth
+    // plies; proven losses are entered into the table
+    int evade(int depth) {
+        if (result) {
+            return result<0;
+        }
+
+        uint64 h = (*this)();
+        uint8 m = table->probe(h);
+        if (m & (WIN | LOSS)) {
+            return (m & LOSS)!=0;
+        }
+
+        nodes++;
+        for (PositionIterator& child=children(); ++child;) {
+            Board& c = child();
+            if (c.result<0 || (!c.result && !c.hunt(depth-1))) {
+                delete &child;
+                return 0;
+            }
+        }
+
+        table->enter(h, depth, -9999);
+        return 1;
+    }
+
+    // search to a given depth, the moves of this position in parallel
+    int search(Pool& pool, int depth) {
+        if (pool.size()==1) {
+            return search(depth);
+        }
+
+        uint64 h = (*this)();
+        int rc = 0;
+        if (!result &&
+            !table->query(h, depth, &rc, NULL, !evaluating) && depth>0) {
+            std::atomic<int> best(-PROVEN);
+            std::atomic<int> searched(0);
+            int n = 0;
+            Group group;
+            for (PositionIterator& child=children(); ++child;) {
+                Board c = child();
+                n++;
+                pool.spawn(group, [c, h, depth, &best, &searched, &group]() mutable {
+                    if (!group.cancelled()) {
+                        // the root is on the path of the worker
+                        path[plies++] = h;
+                        int rc = -c.search(depth-1);
+                        plies--;
+                        searched++;
+                        for (int b=best; rc>b && !best.compare_exchange_weak(b, rc);) ;
+
+                        if (rc>=PROVEN) {
+                            // a winning move makes the other moves irrelevant
+                            group.cancel();
+                        }
+                    }
+                });
+            }
+
+            pool.wait(group);
+            result = best>=PROVEN ? PROVEN : best<=-PROVEN && searched==n ? -PROVEN : 0;
+            if (result || !evaluating) {
+                table->enter(h, depth, result);
+            }
+
+            return best;
+        }
+
+        return rc ? (result = rc>0 ? PROVEN : -PROVEN) : result ? (result>0 ? PROVEN : -PROVEN) : evaluating ? evaluate() : 0;
+    }
+
+    // the positions after all moves, ordered by their static evaluation,
+    // the worst for the other side first
+    int expand(Board* moves, MoveIterator* move) {
+        int score[MOVES];
+        int n = 0;
+        for (Board::PositionIterator& child=children(); ++child;) {
+            if (n<MOVES) {
+                Board c = child();
+                int s = c.result ? c.result : c.evaluate();
+                int i = n++;
+                new(moves+i) Board(c);
+                for (; i>0 && score[i-1]>s; i--) {
+                    moves[i] = moves[i-1];
+                    move[i] = move[i-1];
+                    score[i] = score[i-1];
+                }
+
+                moves[i] = c;
+                move[i] = child.getMove();
+                score[i] = s;
+            }
+        }
+
+        return n;
+    }
+
+    // anytime search, deepening until a proof or the limits; returns the
+    // score of the deepest completed depth with its best move, NOMOVE if
+    // not even depth 1 completed
+    int think(Limit& limit, int* bestMove, int* depth=NULL) {
+        alignas(Board) char storage[MOVES*sizeof(Board)];
+        Board* moves = (Board*) storage;
+        MoveIterator move[MOVES];
+        int n = expand(moves, move);
+
+        int score = 0;
+        *bestMove = NOMOVE;
+        if (depth) {
+            *depth = 0;
+        }
+
+        Board::limit = &limit;
+        uint64 h = (*this)();
+        path[plies++] = h;
+        for (int d=1; d<64 && n && !limit.stopped && score>-PROVEN && score<PROVEN; d++) {
+            int best = -PROVEN;
+            int first = 0;
+            for (int i=0; i<n && best<PROVEN && !limit.stopped; i++) {
+                int rc = -Board(moves[i]).search(d-1, -9999, -best);
+                if (rc>best && !limit.stopped) {
+                    best = rc;
+                    first = i;
+                }
+            }
+
+            if (!limit.stopped) {
+                score = best;
+                *bestMove = move[first].from()*N+move[first].to();
+                if (depth) {
+                    *depth = d;
+                }
+
+                // search the best move of this depth first at the next
+                for (; first>0; first--) {
+                    std::swap(moves[first], moves[first-1]);
+                    std::swap(move[first], move[first-1]);
+                }
+            }
+        }
+
+        plies--;
+        Board::limit = NULL;
+        if (score>=PROVEN || score<=-PROVEN) {
+            table->enter(h, depth ? *depth : 0, score);
+        }
+
+        return score;
+    }
+
+    // recursively search to a given depth with alpha-beta between min and
+    // max, repetitions score as draws; proven wins score PROVEN and proven
+    // losses -PROVEN, others come from the leaves, only proven results are
+    // kept in result; a search stops at the first proven win, so windows
+    // never exclude a proven loss and a cutoff never passes for one
+    int search(int depth, int min=-9999, int max=9999) {
+        Board& b = *this;
+        if (result) {
+            return result>0 ? PROVEN : -PROVEN;
+        }
+
+        uint64 h = b();
+        if (plies>0 && repetition(h)) {
+            return 0;
+        }
+
+        // searches cut by the static evaluation prove nothing about their
+        // depth, they neither mark nor store it
+        int rc = 0;
+        uint8 previous = ILLEGAL;
+        if (table->query(h, depth, &rc, &previous, !evaluating)) {
+            // proven by the table, or searched to this depth before
+            return rc ? (result = rc>0 ? PROVEN : -PROVEN) : evaluating ? b.evaluate() : 0;
+        }
+
+        if (depth<=0) {
+            return evaluating ? b.evaluate() : 0;
+        }
+
+        nodes++;
+        if (limit) {
+            limit->poll(nodes);
+        }
+
+        int outer = repeated;
+        repeated = PATH;
+        if (plies<PATH) {
+            path[plies] = h;
+        }
+
+        plies++;
+
+        alignas(Board) char storage[MOVES*sizeof(Board)];
+        Board* moves = (Board*) storage;
+        MoveIterator move[MOVES];
+        int n = b.expand(moves, move);
+
+        // the result is a loss unless a non-losing move is found, scores
+        // outside min and max are returned as they are so proofs survive
+        // the cutoffs
+        int best = -PROVEN;
+        int i = 0;
+        for (; i<n && best<max && best<PROVEN && !(limit && limit->stopped); i++) {
+            int rc = -moves[i].search(depth-1, -max, -(best>min ? best : min));
+            if (rc>best) {
+                if (verbose && rc>=PROVEN) {
+                    b.print(move[i]);
+                }
+
+                best = rc;
+            }
+        }
+
+        plies--;
+        if (limit && limit->stopped) {
+            // an interrupted search proves nothing, restore the depth the
+            // query marked in advance
+            if (!evaluating) {
+                table->enter(h, (previous>>3)*2, 0);
+            }
+
+            repeated = min(outer, repeated);
+            return 0;
+        }
+
+        // wins and losses never depend on a draw by repetition, but a draw
+        // that went back to a position above this one only holds on this
+        // path, so its depth isn't stored; a loss needs all moves searched
+        result = best>=PROVEN ? PROVEN : best<=-PROVEN && i==n ? -PROVEN : 0;
+        if (result || !evaluating) {
+            table->enter(h, result || repeated>=plies ? depth : 0, result);
+        }
+
+        repeated = min(outer, repeated);
+        if (verbose) {
+            std::cout << std::hex << "0x" << b() << std::dec << std::endl;
+            b.print();
+            std::cout << std::endl;
+        }
+
+        return best;
+    }
+};
+
+// opening book, the sorted records of all positions up to a number of plies
+class Book {
+private:
+    char* records;
+    uint64 entries;
+
+public:
+    // load a book into memory
+    Book(const char* bookname=NULL)
+        : records(NULL), entries(0) {
+        int fd = bookname ? open(bookname, O_RDONLY) : -1;
+        struct stat st;
+        if (fd>=0 && fstat(fd, &st)==0) {
+            records = (char*) malloc(st.st_size+1);
+            if (read(fd, records, st.st_size)==st.st_size) {
+                entries = st.st_size/Record::SIZE;
+            }
+        }
+
+        if (fd>=0) {
+            close(fd);
+        }
+    }
+
+    ~Book() {
+        free(records);
+    }
+
+    operator void*() {
+        return entries ? this : NULL;
+    }
+
+    uint64 size() {
+        return entries;
+    }
+
+    // find the record of a hashvalue by binary search, NULL if not in the book
+    const char* operator[](uint64 h) {
+        uint64 lo = 0;
+        uint64 hi = entries;
+        while (lo<hi) {
+            uint64 mid = (lo+hi)/2;
+            uint64 k = Record::hash(records+mid*Record::SIZE);
+            if (k==h) {
+                return records+mid*Record::SIZE;
+            } else if (k<h) {
+                lo = mid+1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        return NULL;
+    }
+
+    // expand a position breadth first to a number of plies, look up values and
+    // best moves in the hashtable and write the sorted records
+    static uint64 build(const char* bookname, Board& root, int plies) {
+        std::vector<uint64> book(1, root());
+        std::vector<uint64> frontier(book);
+        for (int ply=0; ply<plies && frontier.size(); ply++) {
+            std::vector<uint64> next;
+            for (uint64 i=0; i<frontier.size(); i++) {
+                Board b(frontier[i]);
+                for (Board::PositionIterator& child=b.children(); ++child;) {
+                    // a captured or promoted lion ends the line
+                    uint64 h = child()();
+                    if (h<S && !child().terminal()) {
+                        next.push_back(h);
+                    }
+                }
+            }
+
+            // keep positions not seen at a lower ply
+            std::sort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+            frontier.clear();
+            for (uint64 i=0; i<next.size(); i++) {
+                if (!std::binary_search(book.begin(), book.end(), next[i])) {
+                    frontier.push_back(next[i]);
+                }
+            }
+
+            book.insert(book.end(), frontier.begin(), frontier.end());
+            std::sort(book.begin(), book.end());
+            std::cout << "ply " << ply+1 << ": " << book.size() << " positions\r" << std::flush;
+        }
+
+        Output out(book.size()*Record::SIZE);
+        for (uint64 i=0; i<book.size(); i++) {
+            // a best move only for resolved positions
+            uint8 m = Board::table->probe(book[i]);
+            int move = NOMOVE;
+            if (m & (WIN | LOSS)) {
+                Board b(book[i]);
+                move = b.best();
+            }
+
+            out.commit(Record::pack(out.reserve(Record::SIZE), book[i], m, move));
+        }
+
+        int fd = open(bookname, O_CREAT | O_TRUNC | O_WRONLY, 0664);
+        if (fd<0) {
+            return 0;
+        }
+
+        out.flush(fd);
+        close(fd);
+        return book.size();
+    }
+};
+
+// lookup tables
+uint8 Board::lionPosition[2*L] = { 0, 5, 0, 6, 0, 7, 0, 8, 0, 9, 0, 10, 0, 11, 1, 6, 1, 7, 1, 8, 1, 9, 1, 10, 1, 11, 2, 3, 2, 6, 2, 7, 2, 8, 2, 9, 2, 10, 2, 11, 3, 5, 3, 8, 3, 9, 3, 10, 3, 11, 4, 9, 4, 10, 4, 11, 5, 3, 5, 6, 5, 9, 5, 10, 5, 11, 6, 5, 6, 8, 6, 11, 8, 3, 8, 6, 8, 9 };
+
+uint8 Board::lionGrid[N][N];
+
+uint8 Board::animal[4] = { EMPTY, PIECE_SENTE(CHICK), PIECE_SENTE(ELEPHANT), PIECE_SENTE(GIRAFFE) }; // promote C->D
+
+char Board::picture[2][5+(W+4)*H];
+uint16 Board::reach[2][16][N];
+
+thread_local uint64 Board::nodes = 0;
+thread_local Limit* Board::limit = NULL;
+Table* Board::table = &Table::none;
+thread_local uint64 Board::path[PATH];
+thread_local int Board::plies = 0;
+thread_local int Board::repeated = PATH;
+std::atomic<uint64> Board::repetitions(0);
+int Board::evaluating = 0;
+
+// uniform sampler of legal positions in a range of hashvalues, unranks a
+// random dense index if the index is built, otherwise draws hashvalues until
+// one decodes to a legal board
+class Sampler {
+private:
+    Index& index;
+    uint64 start;
+    uint64 stop;
+    uint64 lo;
+    uint64 hi;
+    uint64 state;
+    uint64 tries;
+
+    // splitmix64
+    uint64 random() {
+        uint64 z = state += 0x9e3779b97f4a7c15ULL;
+        z = (z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+        z = (z^(z>>27))*0x94d049bb133111ebULL;
+        return z^(z>>31);
+    }
+
+    // uniform below n
+    uint64 below(uint64 n) {
+        return ((unsigned __int128) random()*n)>>64;
+    }
+
+public:
+    Sampler(Index& index, uint64 start, uint64 stop, uint64 seed)
+        : index(index), start(start & ~1ULL), stop(min(stop, S)), lo(0), hi(0), state(seed), tries(0) {
+        if (index.built() && this->start<this->stop) {
+            // dense indices of the legal positions in the range
+            lo = 2*index.rank(this->start/2);
+            hi = this->stop>=S ? index.positions() : 2*index.rank(this->stop/2);
+        }
+    }
+
+    // whether the range has no legal positions to draw
+    int empty() {
+        return index.built() ? lo>=hi : start>=stop;
+    }
+
+    // draw a legal hashvalue, ~0 if 1M draws in a row were all illegal
+    uint64 operator()() {
+        if (index.built()) {
+            tries++;
+            return index[lo+below(hi-lo)];
+        }
+
+        for (int i=0; i<1<<20; i++) {
+            uint64 h = start+below(stop-start);
+            tries++;
+            if (Board(h & ~1ULL)) {
+                return h;
+            }
+        }
+
+        return ~0ULL;
+    }
+
+    // hashvalues drawn, including the rejected ones
+    uint64 attempts() {
+        return tries;
+    }
+
+    // number of values drawn from, the legal positions if the index is built
+    uint64 range() {
+        return index.built() ? hi-lo : stop-start;
+    }
+};
+
+// the k won positions with the deepest search depth, in a min-heap keyed by
+// depth and hashvalue, lower hashvalues first among equal depths
+class Longest {
+private:
+    std::vector<uint64> heap;
+    uint64 k;
+
+    static uint64 key(uint64 h, uint8 m) {
+        return ((uint64) (m>>3)<<40) | ((1ULL<<40)-1-h);
+    }
+
+public:
+    Longest(uint64 k=0)
+        : k(k) {
+    }
+
+    void resize(uint64 n) {
+        k = n;
+    }
+
+    // consider a won position
+    void add(uint64 h, uint8 m) {
+        uint64 x = key(h, m);
+        if (heap.size()<k) {
+            heap.push_back(x);
+            std::push_heap(heap.begin(), heap.end(), std::greater<uint64>());
+        } else if (k && x>heap.front()) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<uint64>());
+            heap.back() = x;
+            std::push_heap(heap.begin(), heap.end(), std::greater<uint64>());
+        }
+    }
+
+    Longest& operator+=(const Longest& longest) {
+        for (uint64 i=0; i<longest.heap.size(); i++) {
+            uint64 x = longest.heap[i];
+            add((1ULL<<40)-1-(x & ((1ULL<<40)-1)), (x>>40)<<3);
+        }
+
+        return *this;
+    }
+
+    // print the positions, longest first, with their principal variations
+    void print() {
+        std::vector<uint64> sorted(heap);
+        std::sort(sorted.begin(), sorted.end(), std::greater<uint64>());
+        for (uint64 i=0; i<sorted.size(); i++) {
+            uint64 h = (1ULL<<40)-1-(sorted[i] & ((1ULL<<40)-1));
+            Board b(h);
+            std::cout << std::hex << "0x" << h << std::dec << " won at depth " << 2*(sorted[i]>>40) << std::endl;
+            b.print();
+            std::cout << "pv";
+            b.variation(2*(sorted[i]>>40)+2);
+            std::cout << std::endl << std::endl;
+        }
+    }
+};
+
+// annotate games read from stdin, one game per line as moves in the notation
+// of print(), with the value of every position and whether the move was best
+class Annotator {
+private:
+    Hashtable& hashtable;
+    Board start;
+
+    // moves of all games as from*N+to, NOMOVE ends a game early
+    std::vector<std::vector<int> > games;
+
+    // hashvalues of all positions and alternatives to probe
+    std::vector<uint64> probes;
+
+    static const char* value(int v) {
+        return v>0 ? "won" : v<0 ? "lost" : "unresolved";
+    }
+
+public:
+    Annotator(Hashtable& hashtable, const Board& start)
+        : hashtable(hashtable), start(start) {
+    }
+
+    // read and replay the games, collecting the positions to probe
+    void read(std::istream& in) {
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream moves(line);
+            std::vector<int> game;
+            Board b(start);
+            std::string s;
+            while (moves >> s) {
+                int move = b.parse(s.c_str());
+                game.push_back(move);
+                if (move==NOMOVE) {
+                    break;
+                }
+
+                probes.push_back(b());
+                for (Board::PositionIterator& child=b.children(); ++child;) {
+                    probes.push_back(child()());
+                }
+
+                b = b.after(move);
+            }
+
+            games.push_back(game);
+        }
+    }
+
+    // probe the pages of all games in hashtable order
+    void prefetch() {
+        std::sort(probes.begin(), probes.end());
+        probes.erase(std::unique(probes.begin(), probes.end()), probes.end());
+
+        uint64 page = sysconf(_SC_PAGESIZE);
+        for (uint64 i=0; i<probes.size() && probes[i]<S;) {
+            // read ahead runs of adjacent pages at once
+            uint64 first = probes[i] & ~(page-1);
+            uint64 last = first+page;
+            while (i<probes.size() && probes[i]<S && probes[i]<last+page) {
+                last = (probes[i++] & ~(page-1))+page;
+            }
+
+            hashtable.prefetch(first, last);
+        }
+    }
+
+    // print the games with the value before each move and the best move
+    void print() {
+        for (uint64 g=0; g<games.size(); g++) {
+            std::cout << "game " << g+1 << std::endl;
+            Board b(start);
+            for (uint64 i=0; i<games[g].size(); i++) {
+                int move = games[g][i];
+                if (move==NOMOVE) {
+                    std::cout << std::setw(3) << i+1 << ". illegal move" << std::endl;
+                    break;
+                }
+
+                char s[8];
+                char t[8] = "-";
+                b.notation(s, move);
+                int best = b.best();
+                if (best!=NOMOVE) {
+                    b.notation(t, best);
+                }
+
+                // terminal positions have no best move to compare with
+                Board c = b.after(move);
+                int v = -c.value();
+                int w = best!=NOMOVE ? -b.after(best).value() : v;
+                std::cout << std::setw(3) << i+1 << ". " << std::setw(6) << s << " " << std::setw(10) << value(b.value());
+                if (v==w) {
+                    std::cout << " best" << std::endl;
+                } else {
+                    std::cout << " " << value(v) << " instead of " << value(w) << " after " << t << std::endl;
+                }
+
+                b = c;
+            }
+        }
+    }
+
+    uint64 positions() {
+        return probes.size();
+    }
+};
+
+// statistics of wins, losses and unresolved positions
+class Report {
+private:
+    enum { WON, LOST, OPEN, RESULTS };
+
+    // own and opponent's pieces on hand, pieces on the board, lion pair,
+    // side to move and search depth
+    uint64 hand[D+1][D+1][RESULTS];
+    uint64 board[D+1][RESULTS];
+    uint64 lions[L][RESULTS];
+    uint64 side[2][RESULTS];
+    uint64 depth[32][RESULTS];
+
+    static void json(std::ostream& out, const uint64* counts) {
+        out << "{ \"won\": " << counts[WON] << ", \"lost\": " << counts[LOST] << ", \"unresolved\": " << counts[OPEN] << " }";
+    }
+
+public:
+    Report() {
+        memset(this, 0, sizeof(*this));
+    }
+
+    // count a legal position
+    void add(uint64 h, uint8 m) {
+        int r = m & WIN ? WON : m & LOSS ? LOST : OPEN;
+        int own = 0;
+        int other = 0;
+        Board(h).material(&own, &other);
+
+        hand[own][other][r]++;
+        board[D-own-other][r]++;
+        lions[h>>29][r]++;
+        side[h & 1][r]++;
+        depth[m>>3][r]++;
+    }
+
+    Report& operator+=(const Report& report) {
+        uint64* p = (uint64*) this;
+        const uint64* q = (const uint64*) &report;
+        for (uint64 i=0; i<sizeof(*this)/sizeof(uint64); i++) {
+            p[i] += q[i];
+        }
+
+        return *this;
+    }
+
+    // write the report as JSON
+    void write(std::ostream& out) {
+        out << "{\n  \"hand\": [";
+        for (int i=0; i<=D; i++) {
+            for (int j=0; i+j<=D; j++) {
+                out << (i+j ? ",\n" : "\n") << "    { \"own\": " << i << ", \"opponent\": " << j << ", \"positions\": ";
+                json(out, hand[i][j]);
+                out << " }";
+            }
+        }
+
+        out << "\n  ],\n  \"board\": [";
+        for (int i=0; i<=D; i++) {
+            out << (i ? ",\n" : "\n") << "    { \"pieces\": " << i << ", \"positions\": ";
+            json(out, board[i]);
+            out << " }";
+        }
+
+        out << "\n  ],\n  \"lions\": [";
+        for (int i=0; i<L; i++) {
+            out << (i ? ",\n" : "\n") << "    { \"sente\": " << Board::lion(i, 0) << ", \"gote\": " << Board::lion(i, 1) << ", \"positions\": ";
+            json(out, lions[i]);
+            out << " }";
+        }
+
+        out << "\n  ],\n  \"side\": {\n    \"sente\": ";
+        json(out, side[0]);
+        out << ",\n    \"gote\": ";
+        json(out, side[1]);
+
+        out << "\n  },\n  \"depth\": [";
+        for (int i=0; i<32; i++) {
+            out << (i ? ",\n" : "\n") << "    { \"depth\": " << 2*i << ", \"positions\": ";
+            json(out, depth[i]);
+            out << " }";
+        }
+
+        out << "\n  ]\n}\n";
+    }
+};
+
+// a range of hashvalues processed as a unit by the range kernels
+struct Block {
+    std::atomic<int> state;
+    uint64 index;
+    uint64 start;
+    uint64 stop;
+
+    // legal positions, wins, losses and unresolved positions of the block
+    uint64 n;
+    uint64 w;
+    uint64 l;
+    uint64 u;
+
+    // output for stdout and for a kernel's own file
+    Output out;
+    Output records;
+};
+
+// range kernel, processes the hashvalues of one block at a time
+class Kernel {
+public:
+    virtual ~Kernel() {
+    }
+
+    // read ahead the data of a block, called by the reader stage
+    virtual void prefetch(Block&) {
+    }
+
+    // process a block in a worker of the thread pool
+    virtual void run(Block& block, int id) = 0;
+
+    // write back the results of a block, called by the writer stage in order
+    virtual void commit(Block&) {
+    }
+};
+
+// kernel stepping through the hashtable, K::step is inlined into a loop
+// specialized for each kernel
+template<class K> class Each : public Kernel {
+protected:
+    Hashtable& hashtable;
+
+public:
+    Each(Hashtable& hashtable)
+        : hashtable(hashtable) {
+    }
+
+    void prefetch(Block& block) {
+        hashtable.prefetch(block.start, block.stop);
+    }
+
+    void run(Block& block, int id) {
+        K& kernel = *static_cast<K*>(this);
+        for (uint64 h=block.start; h<block.stop; h++) {
+            kernel.step(block, id, h);
+        }
+    }
+};
+
+// two kernels fused into one loop, A steps before B for each hashvalue
+template<class A, class B> class Fused : public Each<Fused<A, B> > {
+private:
+    A& a;
+    B& b;
+
+public:
+    Fused(Hashtable& hashtable, A& a, B& b)
+        : Each<Fused<A, B> >(hashtable), a(a), b(b) {
+    }
+
+    void step(Block& block, int id, uint64 h) {
+        a.step(block, id, h);
+        b.step(block, id, h);
+    }
+
+    void commit(Block& block) {
+        a.commit(block);
+        b.commit(block);
+    }
+};
+
+// count legal positions, wins and losses
+class Counter : public Each<Counter> {
+public:
+    Counter(Hashtable& hashtable)
+        : Each<Counter>(hashtable) {
+    }
+
+    void step(Block& block, int, uint64 h) {
+        uint8 m = hashtable[h];
+        if (m & LEGAL) {
+            block.n++;
+        }
+
+        if (m & WIN) {
+            if (verbose) {
+                block.out.hex(h) << " wins\n";
             }
 
-            while (!++move && ++piece) {
-                move.reset(piece);
+            block.w++;
+        }
+
+        if (m & LOSS) {
+            if (verbose) {
+                block.out.hex(h) << " loses\n";
+            }
+
+            block.l++;
+        }
+    }
+};
+
+// search unresolved positions to a given depth; positions still unresolved
+// can be queued with the nodes their search took, to search them again at
+// increasing depths, the cheapest first
+class Scanner : public Each<Scanner> {
+private:
+    struct Pending {
+        uint64 cost;
+        uint64 h;
+
+        bool operator<(const Pending& other) const {
+            return cost!=other.cost ? cost<other.cost : h<other.h;
+        }
+    };
+
+    int depth;
+    uint64 queue;
+    int urgency;
+    std::vector<std::vector<Pending> > pending;
+    std::atomic<uint64> dropped;
+
+    // file to record the queue after each pass of escalate(), the range the
+    // queue was collected from and the depth of the next pass
+    std::string checkpointname;
+    uint64 start;
+    uint64 stop;
+    int next;
+
+    // record the queue and the depth of the next pass, written to a new
+    // file first so an interrupted save keeps the previous one
+    void save(const std::vector<Pending>& queued, int d) {
+        std::string name = checkpointname+".new";
+        uint64 header[4] = { start, stop, (uint64) d, queued.size() };
+        uint64 bytes = queued.size()*sizeof(Pending);
+        int fd = open(name.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0664);
+        if (fd>=0 &&
+            write(fd, header, sizeof(header))==sizeof(header) &&
+            (bytes==0 || write(fd, &queued[0], bytes)==(ssize_t) bytes) &&
+            fdatasync(fd)==0) {
+            rename(name.c_str(), checkpointname.c_str());
+        } else {
+            std::cout << "can't save the escalation queue to " << checkpointname << std::endl;
+        }
+
+        if (fd>=0) {
+            close(fd);
+        }
+    }
+
+public:
+    // with queue>0, up to queue unresolved positions per worker are kept
+    // for escalate(), the cheapest to search; with urgency>=0 only positions
+    // of that Board::urgency() are searched
+    Scanner(Hashtable& hashtable, int depth, int workers=1, uint64 queue=0, int urgency=-1)
+        : Each<Scanner>(hashtable), depth(depth), queue(queue), urgency(urgency), pending(workers), dropped(0),
+          start(0), stop(0), next(0) {
+    }
+
+    // record the escalation queue in a file for a range, removed when
+    // escalation is complete; if the file holds the queue of an earlier run
+    // over the same range, it is queued again and the depth of its next
+    // pass returned, the scan need not be repeated; 0 otherwise
+    int resume(const char* name, uint64 start, uint64 stop) {
+        checkpointname = name;
+        this->start = start;
+        this->stop = stop;
+
+        uint64 header[4];
+        int fd = open(name, O_RDONLY);
+        if (fd>=0 && read(fd, header, sizeof(header))==sizeof(header) &&
+            header[0]==start && header[1]==stop && (int) header[2]>depth) {
+            std::vector<Pending>& q = pending[0];
+            uint64 bytes = header[3]*sizeof(Pending);
+            q.resize(header[3]);
+            if (bytes==0 || read(fd, &q[0], bytes)==(ssize_t) bytes) {
+                next = header[2];
+                std::cout << "resuming escalation at depth " << next << " with " << q.size() << " positions" << std::endl;
+            } else {
+                q.clear();
+            }
+        }
+
+        if (fd>=0) {
+            close(fd);
+        }
+
+        return next;
+    }
+
+    void step(Block&, int id, uint64 h) {
+        if ((hashtable[h] & (WIN | LOSS))==0) {
+            Board b(h);
+            if (b && (urgency<0 || b.urgency()==urgency)) {
+                uint64 n = Board::nodes;
+                int rc = b.search(depth);
+                if (rc>-PROVEN && rc<PROVEN && queue) {
+                    // a max-heap by cost, full queues drop their most
+                    // expensive position
+                    Pending p = { Board::nodes-n, h };
+                    std::vector<Pending>& q = pending[id];
+                    if (q.size()<queue) {
+                        q.push_back(p);
+                        std::push_heap(q.begin(), q.end());
+                    } else {
+                        dropped++;
+                        if (p<q.front()) {
+                            std::pop_heap(q.begin(), q.end());
+                            q.back() = p;
+                            std::push_heap(q.begin(), q.end());
+                        }
+                    }
+                }
             }
+        }
+    }
 
-            return *this;
+    void commit(Block& block) {
+        hashtable.commit(block.start, block.stop);
+    }
+
+    // search the queued positions again, two plies deeper per pass up to a
+    // maximum depth, ordered by the nodes of their previous search
+    void escalate(Pool& pool, int maxdepth) {
+        std::vector<Pending> queued;
+        for (uint64 i=0; i<pending.size(); i++) {
+            queued.insert(queued.end(), pending[i].begin(), pending[i].end());
+            std::vector<Pending>().swap(pending[i]);
         }
 
-        Board& operator()() {
-            if (!board) {
-                board = new Board(grid, sente, move);
+        if (dropped) {
+            std::cout << dropped << " unresolved positions too expensive to escalate" << std::endl;
+        }
+
+        struct timeval t0;
+        gettimeofday(&t0, NULL);
+        for (int d=next ? next : depth+2; d<=maxdepth && !queued.empty(); d+=2) {
+            std::sort(queued.begin(), queued.end());
+            std::atomic<uint64> searched(0);
+            std::atomic<uint64> done(0);
+            std::atomic<uint64> resolved(0);
+            uint64 total = queued.size();
+            pool.parallel_for(0, total, 64, [&](uint64 a, uint64 b) {
+                uint64 n0 = Board::nodes;
+                uint64 r = 0;
+                for (uint64 i=a; i<b; i++) {
+                    uint64 n = Board::nodes;
+                    Board board(queued[i].h);
+                    int rc = board.search(d);
+                    queued[i].cost = rc<=-PROVEN || rc>=PROVEN ? (r++, ~0ULL) : Board::nodes-n;
+                }
+
+                searched += Board::nodes-n0;
+                resolved += r;
+                uint64 k = done += b-a;
+                if ((k-(b-a))>>12!=k>>12) {
+                    // print progress every 4k positions
+                    std::cout << "depth " << d << ": " << std::setprecision(3) << 100.0*k/total << "%\r" << std::flush;
+                }
+
+                if (statistics) {
+                    statistics = 0;
+                    struct timeval t;
+                    gettimeofday(&t, NULL);
+                    std::cerr << "escalating to depth " << d << ": " << k << " of " << total << " positions, " << resolved << " resolved, "
+                              << searched << " nodes after " << t.tv_sec-t0.tv_sec << "s" << std::endl;
+                }
+            });
+
+            // drop the positions resolved at this depth
+            queued.erase(std::remove_if(queued.begin(), queued.end(), [](const Pending& p) { return p.cost==~0ULL; }), queued.end());
+            std::cout << "depth " << d << ": " << total-queued.size() << " of " << total << " positions resolved, "
+                      << searched << " nodes" << std::endl;
+
+            if (!checkpointname.empty() && d+2<=maxdepth && !queued.empty()) {
+                save(queued, d+2);
             }
+        }
 
-            return *board;
+        if (!checkpointname.empty()) {
+            // escalation is complete, a rerun starts over
+            unlink(checkpointname.c_str());
         }
+    }
+};
 
-        const PieceIterator& getPiece() const {
-            return piece;
+// search unresolved positions for forced wins by threats to the other lion,
+// the results are copied to the bit planes to seed the retrograde sweeps
+class Hunter : public Each<Hunter> {
+private:
+    Bitplanes* planes;
+    int depth;
+
+public:
+    Hunter(Hashtable& hashtable, Bitplanes* planes, int depth)
+        : Each<Hunter>(hashtable), planes(planes), depth(depth) {
+    }
+
+    // positions are probed through Board::table, so hunting works without
+    // a hashtable file as well
+    void step(Block&, int, uint64 h) {
+        if ((Board::table->probe(h) & (WIN | LOSS))==0) {
+            Board b(h);
+            if (b) {
+                // the shortest wins first
+                int d = 1;
+                while (d<=depth && !b.hunt(d)) {
+                    d += 2;
+                }
+
+                if (planes && d<=depth) {
+                    // the entry hunt() made, whether a table holds it or not
+                    planes->set(h, WIN | LEGAL | (d/2)<<3);
+                }
+            }
         }
+    }
 
-        const MoveIterator& getMove() const {
-            return move;
+    void commit(Block& block) {
+        hashtable.commit(block.start, block.stop);
+    }
+};
+
+// clear loss/win information
+class Cleaner : public Each<Cleaner> {
+public:
+    Cleaner(Hashtable& hashtable)
+        : Each<Cleaner>(hashtable) {
+    }
+
+    void step(Block&, int, uint64 h) {
+        if (hashtable[h] & ~LEGAL) {
+            hashtable[h] &= LEGAL;
         }
+    }
+
+    void commit(Block& block) {
+        hashtable.commit(block.start, block.stop);
+    }
 };
 
+// print legal positions
+class Printer : public Each<Printer> {
+private:
+    int compact;
+
 public:
-    // initialize lookup tables
-    static void initialize() {
-        memset(lionGrid, ~0, sizeof(lionGrid));
-        for (int i=0; i<L; i++) {
-            lionGrid[lionPosition[2*i]][lionPosition[2*i+1]] = i;
+    Printer(Hashtable& hashtable, int compact)
+        : Each<Printer>(hashtable), compact(compact) {
+    }
+
+    // boards are decoded from the hashvalue alone
+    void prefetch(Block&) {
+    }
+
+    void step(Block& block, int, uint64 h) {
+        Board b(h);
+        if (b) {
+            b.format(block.out, h, compact);
         }
     }
+};
 
+// write training records
+class Exporter : public Each<Exporter> {
 private:
-    // determine the order of pieces on hand
-    static int reorder(uint8 p, uint8 q) {
-        return !ANIMAL(p) || (ANIMAL(q) && ANIMAL(p)<ANIMAL(q));
+    int fd;
+    int only;
+
+public:
+    Exporter(Hashtable& hashtable, int fd, int only)
+        : Each<Exporter>(hashtable), fd(fd), only(only) {
     }
 
-    // find a piece on the board
-    int find(uint8 p, int start=0, int end=N) {
-        for (int i=start; i<end; i++) {
-            if (grid[i]==p) {
-                return i;
+    void step(Block& block, int, uint64 h) {
+        uint8 m = hashtable[h];
+        if ((m & LEGAL) && (!only || (only>0)==!!(m & (WIN | LOSS)))) {
+            int move = NOMOVE;
+            if (m & (WIN | LOSS)) {
+                Board b(h);
+                move = b.best();
             }
+
+            block.records.commit(Record::pack(block.records.reserve(Record::SIZE), h, m, move));
         }
+    }
 
-        return end;
+    void commit(Block& block) {
+        block.records.flush(fd);
     }
+};
 
-    // flip the board for gote
-    void flip() {
-        if (!sente) {
-            uint8 g[N];
-            for (int i=0; i<N; i++) {
-                g[i] = grid[N-1-i];
-            }
+// collect statistics, one report per worker
+class Reporter : public Each<Reporter> {
+private:
+    int workers;
+    Report* reports;
 
-            memcpy(grid, g, N);
+public:
+    Reporter(Hashtable& hashtable, int workers)
+        : Each<Reporter>(hashtable), workers(workers), reports(new Report[workers]) {
+    }
 
-            for (int i=0; i<N+D; i++) {
-                if (ANIMAL(grid[i])) {
-                    FLIP(grid[i]);
+    ~Reporter() {
+        delete[] reports;
+    }
+
+    void step(Block&, int id, uint64 h) {
+        if (hashtable[h] & LEGAL) {
+            reports[id].add(h, hashtable[h]);
+        }
+    }
+
+    // merge the reports of all workers and write them as JSON
+    void write(const char* reportname) {
+        for (int i=1; i<workers; i++) {
+            reports[0] += reports[i];
+        }
+
+        std::ofstream report(reportname);
+        reports[0].write(report);
+    }
+};
+
+// find the longest wins, one heap per worker
+class Finder : public Each<Finder> {
+private:
+    int workers;
+    Longest* longest;
+
+public:
+    Finder(Hashtable& hashtable, int workers, uint64 k)
+        : Each<Finder>(hashtable), workers(workers), longest(new Longest[workers]) {
+        for (int i=0; i<workers; i++) {
+            longest[i].resize(k);
+        }
+    }
+
+    ~Finder() {
+        delete[] longest;
+    }
+
+    void step(Block&, int id, uint64 h) {
+        if (hashtable[h] & WIN) {
+            longest[id].add(h, hashtable[h]);
+        }
+    }
+
+    // merge the heaps of all workers and print the positions
+    void print() {
+        for (int i=1; i<workers; i++) {
+            longest[0] += longest[i];
+        }
+
+        longest[0].print();
+    }
+};
+
+// split the hashtable into bit planes, a word at a time
+class Splitter : public Kernel {
+private:
+    Hashtable& hashtable;
+    Bitplanes& planes;
+
+public:
+    Splitter(Hashtable& hashtable, Bitplanes& planes)
+        : hashtable(hashtable), planes(planes) {
+    }
+
+    void run(Block& block, int) {
+        planes.split(hashtable, block.start, block.stop);
+    }
+};
+
+// count from the bit planes, one word per 64 hashvalues
+class PlaneCounter : public Kernel {
+private:
+    Bitplanes& planes;
+
+public:
+    PlaneCounter(Bitplanes& planes)
+        : planes(planes) {
+    }
+
+    void prefetch(Block& block) {
+        planes.prefetch(Bitplanes::PLANE_LEGAL, block.start, block.stop);
+        planes.prefetch(Bitplanes::PLANE_WIN, block.start, block.stop);
+        planes.prefetch(Bitplanes::PLANE_LOSS, block.start, block.stop);
+    }
+
+    void run(Block& block, int) {
+        block.n = planes.count(block.start, block.stop, Bitplanes::PLANE_LEGAL);
+        block.w = planes.count(block.start, block.stop, Bitplanes::PLANE_WIN);
+        block.l = planes.count(block.start, block.stop, Bitplanes::PLANE_LOSS);
+        block.u = planes.count(block.start, block.stop, Bitplanes::PLANE_LEGAL, Bitplanes::PLANE_WIN, Bitplanes::PLANE_LOSS);
+
+        if (verbose) {
+            for (uint64 k=block.start/64; k<(block.stop+63)/64; k++) {
+                for (uint64 m=planes.word(Bitplanes::PLANE_WIN, k) | planes.word(Bitplanes::PLANE_LOSS, k); m; m&=m-1) {
+                    uint64 h = 64*k+__builtin_ctzll(m);
+                    if (h>=block.start && h<block.stop) {
+                        block.out.hex(h) << (planes.word(Bitplanes::PLANE_WIN, k)>>(h%64) & 1 ? " wins\n" : " loses\n");
+                    }
                 }
             }
         }
     }
+};
+
+// scalar retrograde sweep with a word-level skip: words of the bit planes
+// without open legal positions are skipped with a few bitwise operations,
+// every open position of the other words is decoded and its children probed
+// in the planes one at a time; only the new wins and losses are collected
+// in bitmaps and written back a word at a time. The 64 hashvalues of a word
+// differ in the first fields of the encoding and the orientation, and the
+// children of their moves hash to unrelated words, so child results can't
+// be computed for the whole word at once
+class Sweeper : public Kernel {
+private:
+    Hashtable& hashtable;
+    Bitplanes& planes;
+    int mirror;
 
 public:
-    // construct a board from a position string
-    Board(const char* s="ELG C  c gle      ", int sente=1)
-        : sente(sente), illegal(0), result(0) {
-        memset(grid, EMPTY, sizeof(grid));
-        memcpy(grid, s, min(sizeof(grid), strlen(s)));
+    Sweeper(Hashtable& hashtable, Bitplanes& planes, int mirror)
+        : hashtable(hashtable), planes(planes), mirror(mirror) {
     }
 
-    // construct a board from a grid and a move to execute
-    Board(uint8* g, int s, const MoveIterator& move) : sente(0), illegal(0), result(0) {
-        memcpy(grid, g, sizeof(grid));
+    void prefetch(Block& block) {
+        planes.prefetch(Bitplanes::PLANE_LEGAL, block.start, block.stop);
+        planes.prefetch(Bitplanes::PLANE_WIN, block.start, block.stop);
+        planes.prefetch(Bitplanes::PLANE_LOSS, block.start, block.stop);
+    }
 
-        if (ANIMAL(grid[move.to()])) {
-            if (ANIMAL(grid[move.to()])==LION) {
-                // losing the lions loses the game
-                result = -9999;
+    void run(Block& block, int) {
+        for (uint64 k=block.start/64; k<(block.stop+63)/64; k++) {
+            // gote positions are legal iff the sente positions are
+            uint64 legal = planes.word(Bitplanes::PLANE_LEGAL, k);
+            legal |= (legal & 0x5555555555555555ULL)<<1;
+
+            uint64 open = legal & ~planes.word(Bitplanes::PLANE_WIN, k) & ~planes.word(Bitplanes::PLANE_LOSS, k) &
+                Bitplanes::mask(k, block.start, block.stop);
+            uint64 win = 0;
+            uint64 loss = 0;
+            for (uint64 m=open; m; m&=m-1) {
+                int i = __builtin_ctzll(m);
+                Board b(64*k+i);
+                if (b) {
+                    int rc = b.retrograde(planes);
+                    if (rc>0) {
+                        win |= 1ULL<<i;
+                    } else if (rc<0) {
+                        loss |= 1ULL<<i;
+                    }
+                }
             }
 
-            grid[find(EMPTY, N, N+D)] = FLIP(grid[move.to()]);
+            planes.mark(Bitplanes::PLANE_WIN, k, win);
+            planes.mark(Bitplanes::PLANE_LOSS, k, loss);
+            block.w += __builtin_popcountll(win);
+            block.l += __builtin_popcountll(loss);
+
+            if (mirror) {
+                // copy the new results to the hashtable
+                for (uint64 m=win | loss; m; m&=m-1) {
+                    int i = __builtin_ctzll(m);
+                    hashtable[64*k+i] |= (win>>i & 1 ? WIN : LOSS) | LEGAL;
+                }
+            }
         }
+    }
+};
 
-        grid[move.to()] = grid[move.from()];
-        grid[move.from()] = EMPTY;
+// executor for the range kernels, a three stage pipeline: a reader thread
+// reads ahead block k+1, the workers of the thread pool run the kernels on
+// block k and the writer commits block k-1, reports progress and records a
+// checkpoint to resume from
+class Executor {
+private:
+    // states of a block travelling through the pipeline
+    enum { FREE, LOADED, DONE };
+
+    Pool& pool;
+    Group group;
+    uint64 start;
+    uint64 stop;
+    int shift;
+    uint64 blocks;
+    std::vector<Kernel*> kernels;
+
+    // bounded lock-free ring of blocks connecting the stages
+    Block* ring;
+    uint64 slots;
+
+    // file to record the end of the committed blocks
+    int checkpoint;
+    const char* checkpointname;
+
+    // hashvalues processed by each worker, and a file for statistics
+    std::atomic<uint64>* processed;
+    const char* statsname;
+
+    // signalled whenever a block changes state
+    Event moved;
+
+    Block& slot(uint64 k) {
+        return ring[k%slots];
+    }
 
-        if (move.to()>=N-W) {
-            if (ANIMAL(grid[move.to()])==CHICK) {
-                // promote chick
-                PROMOTE(grid[move.to()]);
+    // sleep until a block is in a state
+    void await(Block& b, int state) {
+        for (;;) {
+            uint64 ticket = moved.ticket();
+            if (b.state.load(std::memory_order_acquire)==state) {
+                break;
             }
 
-#if 0
-            if (ANIMAL(grid[move.to()])==LION) {
-                // lion on final rank
-                ...;
-            }
-#endif
+            moved.wait(ticket);
         }
+    }
 
-        flip();
-        sente = !s;
+    // first and last hashvalue of block k, aligned to the block size
+    uint64 first(uint64 k) {
+        return k ? ((start>>shift)+k)<<shift : start;
+    }
 
-        for (int i=N-W; i<N; i++) {
-            if (SENTE(grid[i]) && ANIMAL(grid[i])==LION) {
-                // a lion surving on final rank wins
-                result = 9999;
-                break;
+    uint64 last(uint64 k) {
+        return min(((start>>shift)+k+1)<<shift, stop);
+    }
+
+    // reader stage: read ahead the data of each block and hand it to the pool
+    void reader() {
+        for (uint64 k=0; k<blocks; k++) {
+            Block& b = slot(k);
+            await(b, FREE);
+
+            b.index = k;
+            b.start = first(k);
+            b.stop = last(k);
+            b.n = b.w = b.l = b.u = 0;
+            for (uint64 i=0; i<kernels.size(); i++) {
+                kernels[i]->prefetch(b);
             }
+
+            b.state.store(LOADED, std::memory_order_release);
+            pool.spawn(group, [this, &b] {
+                // run all kernels on the block while it is in the cache
+                for (uint64 i=0; i<kernels.size(); i++) {
+                    kernels[i]->run(b, Pool::self());
+                }
+
+                processed[std::max(Pool::self(), 0)] += b.stop-b.start;
+
+                b.state.store(DONE, std::memory_order_release);
+                moved.signal();
+            }, pool.home(b.start));
         }
     }
 
-    // construct a board from a hashvalue
-    Board(uint64 h)
-        : sente(0), illegal(h>=S), result(0) {
-        if (illegal) {
-            return;
+    // record where to resume
+    void save(uint64 h) {
+        char s[20];
+        int n = snprintf(s, sizeof(s), "0x%llx\n", h);
+        if (pwrite(checkpoint, s, n, 0)==n) {
+            ftruncate(checkpoint, n);
+            fdatasync(checkpoint);
         }
+    }
 
-        memset(grid, EMPTY, sizeof(grid));
+    // dump counters, rates of the workers, residency of the hashtable and
+    // the estimated time to completion to stderr and the statistics file
+    void dump(const struct timeval& t0, uint64 begin, uint64 done) {
+        struct timeval t;
+        gettimeofday(&t, NULL);
+        double elapsed = t.tv_sec-t0.tv_sec+(t.tv_usec-t0.tv_usec)/1e6;
+
+        std::ostringstream out;
+        out << std::setprecision(3) << 100.0*(done-begin)/(stop-begin) << "% of 0x" << std::hex << begin << "-0x" << stop << std::dec
+            << " after " << (int) elapsed << "s, eta " << (done>begin ? (int) (elapsed*(stop-done)/(done-begin)) : -1) << "s" << std::endl
+            << n << " positions, " << w << " wins, " << l << " losses, "
+            << Table::queries() << " queries, " << Table::matches() << " matches" << std::endl;
+        for (int i=0; i<pool.size(); i++) {
+            out << "worker " << i << ": " << (uint64) (processed[i]/elapsed) << "/s" << std::endl;
+        }
 
-        // decode the position of both lions
-        grid[lionPosition[2*(h>>29)]] = PIECE_SENTE(LION);
-        grid[lionPosition[2*(h>>29)+1]] = PIECE_GOTE(LION);
+        uint64 pages;
+        uint64 resident = Hashtable::resident(pages);
+        out << resident << " of " << pages << " pages resident (" << 100.0*resident/(pages ? pages : 1) << "%)" << std::endl;
 
-        // board orientation
-        sente = h & 0x01 ? 0 : 1;
-        h >>= 1;
+        std::cerr << out.str() << std::flush;
+        if (statsname) {
+            std::ofstream file(statsname);
+            file << out.str();
+        }
+    }
 
-        // decode the pieces on the remaining 10 fields
-        uint32 count[4] = { 0 };
-        for (int i=0; i<N && h; i++) {
-            if (!ANIMAL(grid[i])) {
-                if (h & 0x03) {
-                    grid[i] = animal[h & 0x03];
-                    if (++count[h & 0x03]>2) {
-                        illegal++;
-                        return;
-                    }
-                }
+public:
+    // hashvalue a checkpoint resumed from, 0 unless the totals cover only the
+    // rest of the range
+    uint64 resumed;
+
+    // totals over all committed blocks
+    uint64 n;
+    uint64 w;
+    uint64 l;
+    uint64 u;
+
+    Executor(Pool& pool, uint64 start, uint64 stop, int shift)
+        : pool(pool), start(start), stop(stop), shift(shift), slots(2*pool.size()+2),
+          checkpoint(-1), checkpointname(NULL), statsname(NULL), resumed(0), n(0), w(0), l(0), u(0) {
+        ring = new Block[slots];
+        for (uint64 k=0; k<slots; k++) {
+            ring[k].state = FREE;
+        }
 
-                h >>= 2;
+        processed = new std::atomic<uint64>[pool.size()];
+        for (int i=0; i<pool.size(); i++) {
+            processed[i] = 0;
+        }
+    }
+
+    ~Executor() {
+        if (checkpoint>=0) {
+            close(checkpoint);
+        }
+
+        delete[] processed;
+        delete[] ring;
+    }
+
+    // write statistics dumped on SIGUSR1 to a file as well
+    void stats(const char* name) {
+        statsname = name;
+    }
+
+    // kernels run on every block in the order they are added
+    void add(Kernel& kernel) {
+        kernels.push_back(&kernel);
+    }
+
+    // record progress in a file and resume from it, the file is removed
+    // when the range is complete
+    void resume(const char* name) {
+        checkpointname = name;
+        if ((checkpoint = open(checkpointname, O_CREAT | O_RDWR, 0664))>=0) {
+            char s[20] = { 0 };
+            if (read(checkpoint, s, sizeof(s)-1)>0) {
+                uint64 h = strtoull(s, NULL, 0);
+                if (h>start && h<stop) {
+                    std::cout << "resuming at 0x" << std::hex << h << std::dec << std::endl;
+                    start = h;
+                    resumed = h;
+                }
             }
         }
+    }
 
-        // add the remaining pieces to be dropped
-        int a = 3;
-        for (int i=N; i<N+D; i++) {
-            while (a && count[a]>=2) {
-                a--;
+    // run the reader stage in a thread, commit in the calling thread
+    void run(const struct timeval& t0) {
+        uint64 begin = start;
+        blocks = stop>start ? ((stop-1)>>shift)-(start>>shift)+1 : 0;
+        std::thread read(&Executor::reader, this);
+
+        // writer stage: commit blocks in order and print progress
+        struct timeval saved = t0;
+        for (uint64 k=0; k<blocks; k++) {
+            Block& b = slot(k);
+            await(b, DONE);
+
+            std::cout << std::flush;
+            for (uint64 i=0; i<kernels.size(); i++) {
+                kernels[i]->commit(b);
             }
 
-            grid[i] = animal[a];
-            count[a]++;
-        }
+            n += b.n;
+            w += b.w;
+            l += b.l;
+            u += b.u;
 
-        // assign pieces to sente/gote
-        for (int i=0; i<N+D; i++) {
-            if (ANIMAL(grid[i]) && ANIMAL(grid[i])!=LION) {
-                if (h & 0x01) {
-                    grid[i] |= GOTE;
-                }
+            // write the output of the block in one go
+            b.out.flush();
 
-                h >>= 1;
+            struct timeval t;
+            gettimeofday(&t, NULL);
+            if (checkpoint>=0 && t.tv_sec-saved.tv_sec>=10 && k+1<blocks) {
+                // checkpoint every 10s
+                save(b.stop);
+                saved = t;
             }
-        }
 
-        // promote chicks
-        for (int i=0; i<N+D; i++) {
-            if (ANIMAL(grid[i])==CHICK) {
-                if (h & 0x01) {
-                    if (i<N) {
-                        PROMOTE(grid[i]);
-                    } else {
-                        // chicks to drop can't be promoted
-                        illegal++;
-                        return;
-                    }
-                }
+            std::cout << std::setprecision(3) << 100.0*(b.stop-begin)/(stop-begin) << "%";
+            if (shift<16) {
+                std::cout << " " << (t.tv_sec>t0.tv_sec ? (b.stop-begin)/(t.tv_sec-t0.tv_sec) : 0) << "/s" << std::endl;
+            } else {
+                std::cout << "\r" << std::flush;
+            }
 
-                h >>= 1;
+            if (statistics) {
+                statistics = 0;
+                dump(t0, begin, b.stop);
             }
+
+            b.state.store(FREE, std::memory_order_release);
+            moved.signal();
         }
 
-        flip();
-    }
+        read.join();
+        pool.wait(group);
 
-    // check if the board position is legal
-    operator void*() {
-        return illegal ? NULL : this;
+        if (checkpoint>=0) {
+            // the range is complete, a rerun starts over
+            close(checkpoint);
+            checkpoint = -1;
+            unlink(checkpointname);
+        }
     }
+};
 
-    // calculate a hashvalue for the board
-    uint64 operator()() {
-        if (!illegal) {
-            uint64 h = 0;
-            flip();
+// copy a hashtable file, cloning it if the filesystem supports reflinks
+class Snapshot {
+private:
+    // copy in chunks of 64MB, skip blocks of 64kB that are all zero
+    static const uint64 chunk = 1ULL<<26;
+    static const uint64 block = 1ULL<<16;
 
-            int l = find(PIECE_SENTE(LION));
-            int n = find(PIECE_GOTE(LION));
+    int src;
+    int dst;
+    uint64 size;
 
-            if (l>=N || n>=N || lionGrid[l][n]>L) {
-                flip();
-                return ~0;
-            }
+    // ranges of data in the source file, holes are skipped
+    uint64* ranges;
+    uint64 chunks;
+    std::atomic<int> reflink;
+    std::atomic<int> failed;
+    std::atomic<uint64> copied;
 
-            h = lionGrid[l][n];
+    // find the data ranges of the source file and split them into chunks
+    void extents() {
+        uint64 n = 0;
+        for (int pass=0; pass<2; pass++) {
+            chunks = 0;
+            for (off_t data=0, hole; (data = lseek(src, data, SEEK_DATA))>=0; data=hole) {
+                if ((hole = lseek(src, data, SEEK_HOLE))<0) {
+                    hole = size;
+                }
 
-            // promote chicks
-            for (int i=N+D; i--;) {
-                if (ANIMAL(grid[i])==CHICK || ANIMAL(grid[i])==HEN) {
-                    h <<= 1;
-                    if (ANIMAL(grid[i])==HEN) {
-                        h |= 0x01;
+                for (off_t a=data; a<hole; a+=chunk, chunks++) {
+                    if (pass) {
+                        ranges[2*chunks] = a;
+                        ranges[2*chunks+1] = min(a+chunk, (uint64) hole);
                     }
                 }
             }
 
-            // sort pieces on hand
-            for (int i=N; i<N+D-1; i++) {
-                for (int j=i+1; j<N+D; j++) {
-                    if (reorder(grid[i], grid[j])) {
-                        uint8 swap = grid[i];
-                        grid[i] = grid[j];
-                        grid[j] = swap;
-                    }
-                }
+            if (!pass) {
+                n = chunks;
+                ranges = new uint64[2*n+2];
             }
+        }
 
-            // assign pieces to sente/gote
-            for (int i=N+D; i--;) {
-                if (ANIMAL(grid[i]) && ANIMAL(grid[i])!=LION) {
-                    h <<= 1;
-                    if (grid[i] & GOTE) {
-                        h |= 0x01;
-                    }
-                }
+        chunks = min(chunks, n);
+    }
+
+    // copy chunk k
+    void copy(uint64 k) {
+        uint8* buffer = new uint8[block];
+        loff_t a = ranges[2*k];
+        loff_t b = ranges[2*k+1];
+
+        // let the filesystem copy or share the extents
+        while (reflink && a<b) {
+            loff_t in = a;
+            loff_t out = a;
+            ssize_t n = copy_file_range(src, &in, dst, &out, b-a, 0);
+            if (n<=0) {
+                reflink = 0;
+            } else {
+                copied += n;
+                a += n;
             }
+        }
 
-            // encode the pieces on the remaining 10 fields
-            for (int i=N; i--;) {
-                if (ANIMAL(grid[i])!=LION) {
-                    h <<=2;
-                    if (ANIMAL(grid[i])) {
-                        h |= (ANIMAL(grid[i])-CHICK)/2+1;
-                    }
-                }
+        // otherwise copy the data, keeping blocks of zeros sparse
+        for (; a<b && !failed; a+=block) {
+            ssize_t n = pread(src, buffer, min((uint64) (b-a), block), a);
+            if (n!=(ssize_t) min((uint64) (b-a), block)) {
+                failed = 1;
+                break;
             }
 
-            // board orientation
-            h <<= 1;
-            if (!sente) {
-                h |= 1;
+            uint64 i = 0;
+            while (i<(uint64) n && !buffer[i]) {
+                i++;
             }
 
-            flip();
-            return h;
+            if (i<(uint64) n && pwrite(dst, buffer, n, a)!=n) {
+                failed = 1;
+                break;
+            }
+
+            copied += n;
         }
 
-        return ~0;
+        delete[] buffer;
     }
 
-    // print the board
-    void print(const MoveIterator& move = MoveIterator()) {
-        if (!illegal) {
-            std::cout << (sente ? " 321" : " 123") << std::endl;
-            for (int y=H; y--;) {
-                std::cout << "|";
-                for (int x=0; x<W; x++) {
-                    std::cout << grid[y*W+x];
-                }
-                std::cout << "|" << (sente ? H-y : y+1) << std::endl;
+public:
+    // the copy is truncated only once it is known not to be the source
+    Snapshot(const char* srcname, const char* dstname)
+        : src(open(srcname, O_RDONLY | O_LARGEFILE)),
+          dst(open(dstname, O_CREAT | O_LARGEFILE | O_WRONLY, 0664)),
+          size(0), ranges(NULL), chunks(0), reflink(1), failed(0), copied(0) {
+        struct stat st;
+        struct stat dt;
+        if (src<0 || dst<0 || fstat(src, &st) || fstat(dst, &dt) ||
+            (st.st_dev==dt.st_dev && st.st_ino==dt.st_ino) || ftruncate(dst, 0)) {
+            if (dst>=0) {
+                close(dst);
+                dst = -1;
             }
+        } else {
+            size = st.st_size;
+        }
+    }
 
-            int a = 0;
-            for (int i=N; i<N+D; i++) {
-                if (ANIMAL(grid[i])) {
-                    std::cout << grid[i];
-                    a++;
-                }
-            }
+    ~Snapshot() {
+        if (src>=0) {
+            close(src);
+        }
 
-            if (a) {
-                std::cout << std::endl;
-            }
+        if (dst>=0) {
+            close(dst);
+        }
 
-            if (move) {
-                if (sente) {
-                    std::cout << W-(N-1-move.from())%W << (N-1-move.from())/W+1 << "->" << W-(N-1-move.to())%W << (N-1-move.to())/W+1 << " wins" << std::endl << std::endl;
-                } else {
-                    std::cout << move.from()%W+1 << move.from()/W+1 << "->" << move.to()%W+1 << move.to()/W+1 << " wins" << std::endl << std::endl;
-                }
-            }
+        delete[] ranges;
+    }
 
-            if (result) {
-                std::cout << (result>0 ? " is won #" : " is lost #") << result << std::endl;
+    operator void*() {
+        return src>=0 && dst>=0 ? this : NULL;
+    }
+
+    // clone the file in one step, copy the data ranges in parallel
+    // otherwise; NULL if the copy failed
+    const char* copy(Pool& pool) {
+        if (ioctl(dst, FICLONE, src)==0) {
+            return "cloned";
+        }
+
+        if (ftruncate(dst, size)) {
+            return NULL;
+        }
+
+        extents();
+        pool.parallel_for(0, chunks, 1, [this](uint64 a, uint64 b) {
+            for (uint64 k=a; k<b; k++) {
+                copy(k);
             }
+        });
+
+        if (failed || copied<total() || fsync(dst)) {
+            return NULL;
         }
+
+        return reflink ? "copied by the filesystem" : "copied";
     }
 
-    // generate moves
-    PositionIterator& children() {
-        return *new PositionIterator(grid, sente);
+    uint64 bytes() {
+        return copied;
     }
 
-    // recursively search to a given depth
-    int search(int depth, int min=-9999, int max=9999) {
-        Board& b = *this;
-        uint64 h = b();
+private:
+    // bytes in the data ranges of the source
+    uint64 total() {
+        uint64 n = 0;
+        for (uint64 k=0; k<chunks; k++) {
+            n += ranges[2*k+1]-ranges[2*k];
+        }
 
-        if (!result &&
-            !Hashtable::query(h, depth, &result) && depth>0) {
-
-            // the result is a loss unless a non-losing move is found
-            result = min;
-            for (Board::PositionIterator& child=b.children(); result<max && ++child;) {
-                int rc = -child().search(depth-1, -max, -result);
-                if (rc>result) {
-                    if (verbose && rc>0) {
-                        b.print(child.getMove());
-                    }
+        return n;
+    }
+};
+
+// read ahead the table pages of the children and grandchildren of a position
+static void warm(Hashtable& hashtable, Board& b) {
+    for (Board::PositionIterator& child=b.children(); ++child;) {
+        uint64 h = child()();
+        hashtable.prefetch(h, h+1);
+        for (Board::PositionIterator& grandchild=child().children(); ++grandchild;) {
+            uint64 g = grandchild()();
+            hashtable.prefetch(g, g+1);
+        }
+    }
+}
+
+// choose a move from the book, the table or a search of about a second
+static int reply(Board& b, Book& book, int* depth) {
+    const char* r = book[b()];
+    *depth = 0;
+    if (r && Record::value(r) && Record::move(r)!=NOMOVE) {
+        // only the moves of resolved positions are best moves
+        return Record::move(r);
+    }
 
-                    result = rc;
+    int move = NOMOVE;
+    if (!b.value()) {
+        // score the leaves by the static evaluation to choose among the
+        // unresolved moves
+        int evaluating = Board::evaluating;
+        Board::evaluating = 1;
+        Limit limit(0, 1000, Board::nodes);
+        Board(b).think(limit, &move, depth);
+        Board::evaluating = evaluating;
+    }
+
+    return b.value() || move==NOMOVE ? b.best() : move;
+}
+
+// text interface to play against the table, the human moves first unless gote
+static void play(Hashtable& hashtable, Book& book, Board b, int human) {
+    for (int turn=human;; turn=!turn) {
+        warm(hashtable, b);
+        b.print();
+        std::cout << (b.value()>0 ? "won" : b.value()<0 ? "lost" : "unresolved") << " for the side to move" << std::endl;
+
+        int move = NOMOVE;
+        if (turn) {
+            std::string s;
+            while (move==NOMOVE) {
+                std::cout << "> " << std::flush;
+                if (!(std::cin >> s) || s=="quit") {
+                    return;
+                }
+
+                if ((move = b.parse(s.c_str()))==NOMOVE) {
+                    std::cout << "illegal move " << s << std::endl;
                 }
             }
+        } else {
+            struct timeval t0;
+            gettimeofday(&t0, NULL);
 
-            Hashtable::enter(h, depth, result);
-            if (verbose) {
-                std::cout << std::hex << "0x" << b() << std::dec << std::endl;
-                b.print();
-                std::cout << std::endl;
+            int depth;
+            if ((move = reply(b, book, &depth))==NOMOVE) {
+                std::cout << "no move" << std::endl;
+                return;
             }
-        }
 
-        return result;
-    }
-};
+            struct timeval t;
+            gettimeofday(&t, NULL);
 
-// lookup tables
-uint8 Board::lionPosition[2*L] = { 0, 5, 0, 6, 0, 7, 0, 8, 0, 9, 0, 10, 0, 11, 1, 6, 1, 7, 1, 8, 1, 9, 1, 10, 1, 11, 2, 3, 2, 6, 2, 7, 2, 8, 2, 9, 2, 10, 2, 11, 3, 5, 3, 8, 3, 9, 3, 10, 3, 11, 4, 9, 4, 10, 4, 11, 5, 3, 5, 6, 5, 9, 5, 10, 5, 11, 6, 5, 6, 8, 6, 11, 8, 3, 8, 6, 8, 9 };
+            char s[8];
+            b.notation(s, move);
+            std::cout << s;
+            if (depth) {
+                std::cout << " (searched to depth " << depth << ")";
+            }
 
-uint8 Board::lionGrid[N][N];
+            std::cout << " in " << (t.tv_sec-t0.tv_sec)*1000+(t.tv_usec-t0.tv_usec)/1000 << "ms" << std::endl;
+        }
 
-uint8 Board::animal[4] = { EMPTY, PIECE_SENTE(CHICK), PIECE_SENTE(ELEPHANT), PIECE_SENTE(GIRAFFE) }; // promote C->D
+        b = b.after(move);
+        if (b.terminal()) {
+            b.print();
+            std::cout << (b.terminal()>0 ? "lost" : "won") << " by " << (turn ? "you" : "me") << std::endl;
+            return;
+        }
+    }
+}
+
+static void usr1Handler(int) {
+    // the executor dumps the statistics between two blocks
+    statistics = 1;
+}
 
 static void intHandler(int) {
     std::cout << std::endl << "got ^C, exiting ..." << std::endl;
@@ -688,6 +4210,32 @@ static void intHandler(int) {
 }
 
 int main(int argc, const char** argv) {
+    if (argc==4 && !strcmp(argv[1], "snapshot")) {
+        // branch a hashtable
+        struct timeval t0;
+        gettimeofday(&t0, NULL);
+
+        Snapshot snapshot(argv[2], argv[3]);
+        if (!snapshot) {
+            std::cout << "can't open " << argv[2] << " or " << argv[3] << ", or they are the same file" << std::endl;
+            return 1;
+        }
+
+        Pool pool(sysconf(_SC_NPROCESSORS_ONLN));
+        const char* how = snapshot.copy(pool);
+        if (!how) {
+            std::cout << "copy failed after " << snapshot.bytes() << " bytes" << std::endl;
+            return 1;
+        }
+
+        std::cout << how << ", " << snapshot.bytes() << " bytes of data" << std::endl;
+
+        struct timeval t;
+        gettimeofday(&t, NULL);
+        std::cout << t.tv_sec - t0.tv_sec << "s" << std::endl;
+        return 0;
+    }
+
     // command line options
     int check = 0;
     int count = 0;
@@ -695,28 +4243,115 @@ int main(int argc, const char** argv) {
     int empty = 0;
     int gote = 0;
     int print = argc==1;
+    int compact = 0;
     int scan = 0;
+    int split = 0;
+    int retro = 0;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int pin = 0;
+    int smt = 1;
+    int numa = 0;
     const char* pos = "ELG C  c gle      ";
     uint64 start = 0;
     uint64 stop = S;
     const char* hashtablename = NULL;
+    const char* planesname = NULL;
+    const char* indexname = NULL;
+    const char* densename = NULL;
+    const char* archivename = NULL;
+    uint64 cachesize = 0;
+    const char* exportname = NULL;
+    const char* bookname = NULL;
+    const char* lookupname = NULL;
+    const char* reportname = NULL;
+    const char* checkpointname = NULL;
+    const char* statsname = NULL;
+    uint64 estimate = 0;
+    int longest = 0;
+    int escalate = 0;
+    int priority = 0;
+    int hunt = 0;
+    uint64 budget = 0;
+    int64 deadline = 0;
+    int annotate = 0;
+    int game = 0;
+    int only = 0;
     for (int i=1; i<argc; i++) {
-        if (!strcmp(argv[i], "-b") && i+1<argc) {
+        if (!strcmp(argv[i], "book") && i+1<argc) {
+            bookname = argv[++i];
+        } else if (!strcmp(argv[i], "--report") && i+1<argc) {
+            reportname = argv[++i];
+        } else if (!strcmp(argv[i], "--checkpoint") && i+1<argc) {
+            checkpointname = argv[++i];
+        } else if (!strcmp(argv[i], "--cache") && i+1<argc) {
+            cachesize = strtoull(argv[++i], NULL, 0)<<20;
+        } else if (!strcmp(argv[i], "--archive") && i+1<argc) {
+            archivename = argv[++i];
+        } else if (!strcmp(argv[i], "--estimate") && i+1<argc) {
+            estimate = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--escalate") && i+1<argc) {
+            escalate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--budget") && i+1<argc) {
+            budget = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--deadline") && i+1<argc) {
+            deadline = strtoll(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--hunt") && i+1<argc) {
+            hunt = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--evaluate")) {
+            Board::evaluating = 1;
+        } else if (!strcmp(argv[i], "--priority")) {
+            priority = 1;
+        } else if (!strcmp(argv[i], "--stats") && i+1<argc) {
+            statsname = argv[++i];
+        } else if (!strcmp(argv[i], "--pin")) {
+            pin = 1;
+        } else if (!strcmp(argv[i], "--nosmt")) {
+            pin = 1;
+            smt = 0;
+        } else if (!strcmp(argv[i], "--numa")) {
+            pin = 1;
+            numa = 1;
+        } else if (!strcmp(argv[i], "--longest") && i+1<argc) {
+            longest = strtoll(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "play")) {
+            game = 1;
+        } else if (!strcmp(argv[i], "-a")) {
+            annotate = 1;
+        } else if (!strcmp(argv[i], "-b") && i+1<argc) {
             pos = argv[++i];
         } else if (!strcmp(argv[i], "-c")) {
             empty = 1;
         } else if (!strcmp(argv[i], "-d") && i+1<argc) {
             depth = strtoll(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-D") && i+1<argc) {
+            densename = argv[++i];
+        } else if (!strcmp(argv[i], "-e") && i+1<argc) {
+            exportname = argv[++i];
         } else if (!strcmp(argv[i], "-f") && i+1<argc) {
             hashtablename = argv[++i];
         } else if (!strcmp(argv[i], "-g")) {
             gote = 1;
         } else if (!strcmp(argv[i], "-i")) {
             check = 1;
+        } else if (!strcmp(argv[i], "-I") && i+1<argc) {
+            indexname = argv[++i];
+        } else if (!strcmp(argv[i], "-j") && i+1<argc) {
+            threads = strtoll(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-k") && i+1<argc) {
+            lookupname = argv[++i];
         } else if (!strcmp(argv[i], "-n")) {
             count = 1;
+        } else if (!strcmp(argv[i], "-o") && i+1<argc) {
+            only = !strcmp(argv[++i], "resolved") ? 1 : !strcmp(argv[i], "unresolved") ? -1 : 0;
         } else if (!strcmp(argv[i], "-p")) {
             print = 1;
+        } else if (!strcmp(argv[i], "-P") && i+1<argc) {
+            planesname = argv[++i];
+        } else if (!strcmp(argv[i], "-R")) {
+            retro = 1;
+        } else if (!strcmp(argv[i], "-q")) {
+            print = 1;
+            compact = 1;
         } else if (!strcmp(argv[i], "-r")) {
             scan = 1;
         } else if (!strcmp(argv[i], "-s") && i+1<argc) {
@@ -725,15 +4360,51 @@ int main(int argc, const char** argv) {
             stop = strtoll(argv[++i], NULL, 0);
         } else if (!strcmp(argv[i], "-v")) {
             verbose = 1;
+        } else if (!strcmp(argv[i], "-x")) {
+            split = 1;
         } else {
-            std::cout << "usage: " << argv[0] << " [-c] [-i] -f hashtable] [-n] [-p] [-r] [-s <start>] [-t <stop>] [-v]" << std::endl
+            std::cout << "usage: " << argv[0] << " [-c] [-D <dense>] [-e <records>] [-i] -f hashtable] [-I <index>] [-j <threads>] [-n] [-o resolved|unresolved] [-p] [-P <planes>] [-q] [-r] [-R] [-s <start>] [-t <stop>] [-v] [-x] [--archive <dense>] [--budget <nodes>] [--cache <MB>] [--checkpoint <file>] [--deadline <ms>] [--escalate <depth>] [--estimate <samples>] [--evaluate] [--hunt <depth>] [--priority] [--stats <file>] [--pin] [--nosmt] [--numa] [--longest <k>] [--report <json>]" << std::endl
                       << "usage: " << argv[0] << " [-b <board>] [-d <depth>] [-g] [-f hashtable] [-v]" << std::endl
+                      << "usage: " << argv[0] << " [-b <board>] [-d <plies>] [-g] [-f hashtable] book <book>" << std::endl
+                      << "usage: " << argv[0] << " [-b <board>] [-g] -k <book>" << std::endl
+                      << "usage: " << argv[0] << " [-b <board>] [-g] -f hashtable -a < games" << std::endl
+                      << "usage: " << argv[0] << " [-b <board>] [-g] [-k <book>] -f hashtable play" << std::endl
+                      << "usage: " << argv[0] << " snapshot <hashtable> <copy>" << std::endl
+                      << "-a: annotate games from stdin, one per line, moves like '32->22' or 'C*22'" << std::endl
                       << "-c: clear hashtable loss/win information" << std::endl
+                      << "-D: store legal positions in a dense array, requires -I" << std::endl
+                      << "-e: export 8 byte training records: hashvalue (5 bytes), value, depth, best move from*12+to" << std::endl
                       << "-g: gote" << std::endl
+                      << "play: play the board against the table, you move first unless -g" << std::endl
+                      << "book: write an opening book of all positions up to <plies> (default 8) from the board" << std::endl
                       << "-i: initialize hashtable" << std::endl
+                      << "-I: rank/select index over legal positions, built from the hashtable if new" << std::endl
+                      << "-k: look up the board in an opening book" << std::endl
+                      << "-j: number of worker threads, 1 with -v to keep the output in order" << std::endl
                       << "-n: count legal positions in hashtable" << std::endl
+                      << "-o: export resolved or unresolved positions only" << std::endl
                       << "-p: print legal positions" << std::endl
+                      << "-P: bit planes, -n counts from them unless combined with -c, -p, -r or -x" << std::endl
+                      << "-q: print legal positions compactly, one per line" << std::endl
                       << "-r: scan hashtable for wins/losses" << std::endl
+                      << "-R: scalar retrograde sweeps over the bit planes until no more wins/losses are found" << std::endl
+                      << "-x: split hashtable into bit planes" << std::endl
+                      << "--archive: consult a dense array written by -D on misses of the hashtable, requires -I" << std::endl
+                      << "--budget: search the board with iterative deepening until a number of nodes" << std::endl
+                      << "--cache: keep the positions searched most recently in a cache of MB in front of the hashtable" << std::endl
+                      << "--checkpoint: record progress of the range modes in a file and resume from it, with --escalate the queue of positions in <file>.escalate" << std::endl
+                      << "--deadline: search the board with iterative deepening until a number of milliseconds" << std::endl
+                      << "--escalate: search positions still unresolved after -r again, two plies deeper per pass up to a depth" << std::endl
+                      << "--estimate: estimate the legal, resolved, won and lost positions of the range from uniform samples, by lion pair" << std::endl
+                      << "--evaluate: score the leaves of the search by material, lion advancement and safety instead of as draws" << std::endl
+                      << "--hunt: search the range for forced wins by lion threats and safe tries up to a depth first" << std::endl
+                      << "--priority: with -r, search positions with capture threats or advanced lions first" << std::endl
+                      << "--stats: file to write the statistics dumped on SIGUSR1 to" << std::endl
+                      << "--pin: pin worker threads to CPUs, physical cores before their SMT siblings" << std::endl
+                      << "--nosmt: pin worker threads to one CPU per physical core" << std::endl
+                      << "--numa: pin worker threads to the NUMA node of their partition of the hashtable" << std::endl
+                      << "--longest: print the k wins found at the greatest depth with their principal variations" << std::endl
+                      << "--report: write statistics by pieces on hand and on board, lion pair, side and depth" << std::endl
                       << "defaults:" << std::endl
                       << "board='ELG C  c gle      '" << std::endl
                       << "start=0, stop=" << std::hex << S << std::dec << std::endl;
@@ -742,10 +4413,57 @@ int main(int argc, const char** argv) {
     }
 
     Board::initialize();
+    if (Board(pos, !gote)()>=S) {
+        std::cout << "illegal board '" << pos << "'" << std::endl;
+        return 1;
+    }
+
     Hashtable hashtable(S, hashtablename);
+    Bitplanes planes(S, planesname);
+    Index index(S, indexname);
+    Topology topology(verbose ? 1 : threads, smt, numa);
+    Pool pool(verbose ? 1 : threads, pin ? &topology : NULL);
+    topology.print(std::cerr, pin);
+    if (numa && hashtable) {
+        topology.bind((uint8*) (void*) hashtable, S);
+    }
+
+    // searches consult the cache, then the hashtable, then the archive
+    Cache cache(cachesize);
+    Dense archive(index, archivename && index.built() ? archivename : NULL, 0);
+    if (archivename && !archive) {
+        std::cout << "no archive" << std::endl;
+    }
+
+    Board::table = &hashtable;
+    if (archive) {
+        hashtable.chain(archive);
+    }
+
+    if (cache) {
+        Board::table = &cache.chain(*Board::table);
+    }
+
     signal(SIGINT, intHandler);
+    signal(SIGUSR1, usr1Handler);
+
+    if (!planes) {
+        if (planesname || split || retro) {
+            std::cout << "no bit planes" << std::endl;
+        }
 
-    if (!hashtable) {
+        split = 0;
+        retro = 0;
+    }
+
+    if (split && !(hashtablename && hashtable)) {
+        // the planes are split from a hashtable file, without one the table
+        // in memory is empty and would overwrite them
+        std::cout << "no hashtable to split" << std::endl;
+        return 1;
+    }
+
+    if (!hashtable && !(planes && count && !empty && !print)) {
         if (check || empty || count) {
             std::cout << "no hashtable" << std::endl;
         }
@@ -755,120 +4473,395 @@ int main(int argc, const char** argv) {
         count = 0;
     }
 
+    if (!hashtable && (exportname || reportname || longest)) {
+        // the exporter, the reporter and the finder read the hashtable
+        std::cout << "no hashtable" << std::endl;
+        exportname = NULL;
+        reportname = NULL;
+        longest = 0;
+    }
+
     struct timeval t0;
     gettimeofday(&t0, NULL);
 
     if (check) {
         // iterate over all possible hashvalues, sente only (+=2)
-        uint64 n = 0;
-        for (uint64 h=start; h<stop; h+=2) {
-            if ((h & ((1<<21)-1))==0) {
-                // print progress every 1M moves
-                std::cout << std::setprecision(3) << 100.0*h/(stop-start) << "%\r" << std::flush;
+        std::atomic<uint64> n(0);
+        std::atomic<uint64> done(0);
+        Group group;
+        pool.parallel_for(start, stop, 1<<16, [&](uint64 a, uint64 b) {
+            uint64 m = 0;
+            for (uint64 h=(a+1) & ~1ULL; h<b && !group.cancelled(); h+=2) {
+                Board board(h);
+
+                // count legal positions
+                if (board) {
+                    m++;
+
+                    if (board()==h) {
+                        hashtable[h] |= LEGAL;
+                    } else {
+                        std::cout << std::hex << "0x" << h << "/" << "0x" << board() << std::dec << std::endl;
+                        group.cancel();
+                    }
+                }
             }
 
-            Board b(h);
+            n += m;
+            uint64 d = done += b-a;
+            if ((d-(b-a))>>21!=d>>21) {
+                // print progress every 1M moves
+                std::cout << std::setprecision(3) << 100.0*d/(stop-start) << "%\r" << std::flush;
+            }
+        }, &group);
 
-            // count legal positions
-            if (b) {
-                n++;
+        // 474092736 positions
+        std::cout << n << " positions (" << 100.0*n/((stop-start)/2) << "%)" << std::endl;
+    }
 
-                if (check) {
-                    if (b()==h) {
-                        hashtable[h] |= LEGAL;
-                    } else {
-                        std::cout << std::hex << "0x" << h << "/" << "0x" << b() << std::dec << std::endl;
+    if (index && !index.built()) {
+        // map legal positions to a dense index, only from a hashtable file:
+        // without one the table in memory is empty and the index, once
+        // marked built, would be trusted with no positions
+        if (hashtablename && hashtable) {
+            index.build(hashtable);
+            std::cout << index.positions() << " positions indexed" << std::endl;
+        } else {
+            std::cout << "no hashtable to index" << std::endl;
+        }
+    }
 
-                        break;
+    if (densename) {
+        if (index.built()) {
+            Dense dense(index, densename);
+            if (dense) {
+                // blocks are independent, each starts at its rank
+                std::atomic<uint64> done(0);
+                uint64 blocks = index.blockcount();
+                pool.parallel_for(0, blocks, 1<<8, [&](uint64 a, uint64 b) {
+                    dense.fill(hashtable, a, b);
+                    uint64 d = done += b-a;
+                    if ((d-(b-a))>>12!=d>>12) {
+                        // print progress every 2M positions
+                        std::cout << std::setprecision(3) << 100.0*d/blocks << "%\r" << std::flush;
                     }
+                });
+
+                std::cout << index.positions() << " positions stored" << std::endl;
+            }
+        } else {
+            std::cout << "no index" << std::endl;
+        }
+    }
+
+    if (bookname) {
+        // expand the board and record values and best moves
+        Board b(pos, !gote);
+        uint64 n = Book::build(bookname, b, depth ? depth : 8);
+        std::cout << n << " positions in " << bookname << std::endl;
+        depth = 0;
+    }
+
+    if (lookupname && !game) {
+        Book book(lookupname);
+        Board b(pos, !gote);
+        const char* r = book[b()];
+        if (r) {
+            Board q(b());
+            q.print();
+
+            char move[8] = "-";
+            if (Record::move(r)!=NOMOVE) {
+                q.notation(move, Record::move(r));
+            }
+
+            std::cout << (Record::value(r)>0 ? "won" : Record::value(r)<0 ? "lost" : "unresolved") << " at depth " << Record::depth(r) << ", best move " << move << std::endl;
+        } else {
+            std::cout << "not in book" << std::endl;
+        }
+    }
+
+    if (game || annotate) {
+        Table::progress = 0;
+    }
+
+    if (game) {
+        Book book(lookupname);
+        play(hashtable, book, Board(pos, 1), !gote);
+    }
+
+    if (annotate) {
+        // replay all games first, then probe their positions in page order
+        Annotator annotator(hashtable, Board(pos, !gote));
+        annotator.read(std::cin);
+        annotator.prefetch();
+        annotator.print();
+        std::cout << annotator.positions() << " positions probed" << std::endl;
+    }
+
+    if (estimate) {
+        // sample legal positions in parallel, every chunk with its own seed
+        uint64 samples[L] = { 0 };
+        uint64 resolved[L] = { 0 };
+        uint64 wins[L] = { 0 };
+        uint64 losses[L] = { 0 };
+        uint64 attempts = 0;
+        std::mutex mutex;
+        pool.parallel_for(0, estimate, 1<<14, [&](uint64 a, uint64 b) {
+            Sampler sample(index, start, stop, a*0x2545f4914f6cdd1dULL+t0.tv_usec);
+            if (sample.empty()) {
+                return;
+            }
+
+            uint64 n[L] = { 0 };
+            uint64 r[L] = { 0 };
+            uint64 w[L] = { 0 };
+            uint64 l[L] = { 0 };
+            for (uint64 i=a; i<b; i++) {
+                uint64 h = sample();
+                if (h==~0ULL) {
+                    // no legal positions to be found in the range
+                    break;
                 }
+
+                uint8 m = Board::table->probe(h);
+                n[h>>29]++;
+                r[h>>29] += (m & (WIN | LOSS))!=0;
+                w[h>>29] += (m & WIN)!=0;
+                l[h>>29] += (m & LOSS)!=0;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int k=0; k<L; k++) {
+                samples[k] += n[k];
+                resolved[k] += r[k];
+                wins[k] += w[k];
+                losses[k] += l[k];
+            }
+
+            attempts += sample.attempts();
+        });
+
+        // fractions with 95% confidence intervals, by lion pair and overall
+        uint64 n = 0;
+        uint64 r = 0;
+        uint64 w = 0;
+        uint64 l = 0;
+        std::cout << std::setprecision(3);
+        for (int k=0; k<=L; k++) {
+            if (k<L) {
+                n += samples[k];
+                r += resolved[k];
+                w += wins[k];
+                l += losses[k];
             }
+
+            uint64 s = k<L ? samples[k] : n;
+            if (!s || (k<L && !verbose)) {
+                continue;
+            }
+
+            double f[3] = { (double) (k<L ? resolved[k] : r)/s, (double) (k<L ? wins[k] : w)/s, (double) (k<L ? losses[k] : l)/s };
+            const char* name[3] = { "resolved", "wins", "losses" };
+            if (k<L) {
+                std::cout << "lion pair " << k << ": ";
+            } else {
+                std::cout << "all: ";
+            }
+
+            std::cout << s << " samples";
+            for (int i=0; i<3; i++) {
+                std::cout << ", " << name[i] << " " << 100*f[i] << "% +-" << 196*sqrt(f[i]*(1-f[i])/s) << "%";
+            }
+
+            std::cout << std::endl;
         }
 
-        // 474092736 positions
-        std::cout << n << " positions (" << 100.0*n/((stop-start)/2) << "%)" << std::endl;
+        if (n) {
+            // legal positions of the range, exact from the index, otherwise
+            // estimated from the rejections
+            Sampler sample(index, start, stop, 0);
+            double positions = (double) sample.range()*n/attempts;
+            std::cout << (index.built() ? "" : "~") << (uint64) positions << " positions, ~"
+                      << (uint64) (positions*w/n) << " wins, ~" << (uint64) (positions*l/n) << " losses" << std::endl;
+        } else {
+            std::cout << "no positions" << std::endl;
+        }
     }
 
-    if (!scan && depth) {
+    if (!scan && (deadline || budget)) {
+        // search until the deadline or the node budget
+        Board b(pos, !gote);
+        Limit limit(budget, deadline, Board::nodes);
+        int move;
+        int d;
+        int score = b.think(limit, &move, &d);
+
+        char m[8] = "none";
+        if (move!=NOMOVE) {
+            b.notation(m, move);
+        }
+
+        std::cout << "depth " << d << ": score " << score << ", move " << m << ", " << Board::nodes << " nodes" << std::endl;
+    } else if (!scan && depth) {
         // search to the given depth
         for (int d=0; d++<depth;) {
             Board b(pos, !gote);
             std::cout << "depth " << d << "\r" << std::flush;
-            b.search(d);
-            std::cout << Hashtable::wins() << " wins, " << Hashtable::losses() << " losses, " << Hashtable::queries() << " queries, " << Hashtable::matches() << " matches" << std::endl;
+            b.search(pool, d);
+            std::cout << Table::wins() << " wins, " << Table::losses() << " losses, " << Table::queries() << " queries, " << Table::matches() << " matches, "
+                      << Board::repetitions << " repetitions" << std::endl;
         }
     }
 
-    if (count || empty || print || scan) {
-        // count positions
-        uint64 n = 0;
-        uint64 w = 0;
-        uint64 l = 0;
+    int exportfd = -1;
+    if (exportname && (exportfd = open(exportname, O_CREAT | O_TRUNC | O_LARGEFILE | O_WRONLY, 0664))<0) {
+        std::cout << "can't open " << exportname << std::endl;
+    }
 
+    if (count || empty || print || scan || split || exportfd>=0 || reportname || longest || hunt) {
         if (depth==0) {
             // search all nodes to depth 4
             depth = 4;
         }
 
-        for (uint64 h=start; h<stop; h+=1) {
-            if ((h & ((1<<(scan ? 14 : 21))-1))==0) {
-                // print progress every 1M moves
-                struct timeval t;
-                gettimeofday(&t, NULL);
-                std::cout << std::setprecision(3) << 100.0*h/(stop-start) << "%";
-                if (scan) {
-                    std::cout << " " << (t.tv_sec>t0.tv_sec ? (h-start)/(t.tv_sec-t0.tv_sec) : 0) << "/s" << std::endl;
-                } else {
-                    std::cout << "\r" << std::flush;
-                }
-            }
+        if (hunt) {
+            // seed the table with forced wins
+            uint64 wins = Table::wins();
+            uint64 losses = Table::losses();
+            Executor executor(pool, start, stop, 14);
+            Hunter hunter(hashtable, planes ? &planes : NULL, hunt);
+            executor.add(hunter);
+            executor.stats(statsname);
+            executor.run(t0);
+
+            std::cout << "hunt: " << Table::wins()-wins << " wins, " << Table::losses()-losses << " losses" << std::endl;
+        }
 
-            if (hashtable[h] & LEGAL) {
-                n++;
+        if (scan && priority) {
+            // search the positions closest to their end first, they resolve
+            // at shallow depth and shorten the searches of the others
+            for (int urgency=3; urgency>0; urgency--) {
+                uint64 wins = Table::wins();
+                uint64 losses = Table::losses();
+                Executor executor(pool, start, stop, 14);
+                Scanner scanner(hashtable, depth, pool.size(), 0, urgency);
+                executor.add(scanner);
+                executor.stats(statsname);
+                executor.run(t0);
+
+                std::cout << "urgency " << urgency << ": " << Table::wins()-wins << " wins, " << Table::losses()-losses << " losses" << std::endl;
             }
+        }
 
-            if (hashtable[h] & WIN) {
-                if (verbose) {
-                    std::cout << "0x" << std::hex << h << std::dec << " wins" << std::endl;
-                }
+        // report progress every 16k positions when scanning, every 2M otherwise
+        Executor executor(pool, start, stop, scan ? 14 : 21);
+        if (checkpointname) {
+            executor.resume(checkpointname);
+        }
 
-                w++;
-            }
+        executor.stats(statsname);
 
-            if (hashtable[h] & LOSS) {
-                if (verbose) {
-                    std::cout << "0x" << std::hex << h << std::dec << " loses" << std::endl;
-                }
+        Printer printer(hashtable, compact);
+        if (print) {
+            executor.add(printer);
+        }
 
-                l++;
-            }
+        Reporter reporter(hashtable, pool.size());
+        if (reportname) {
+            executor.add(reporter);
+        }
 
-            if (print) {
-                Board b(h);
-                if (b) {
-                    std::cout << std::hex << "0x" << h << std::dec << std::endl;
-                    b.print();
-                    std::cout << std::endl;
-                }
-            }
+        Finder finder(hashtable, pool.size(), longest);
+        if (longest) {
+            executor.add(finder);
+        }
 
-            if (scan) {
-                if ((hashtable[h] & (WIN | LOSS))==0) {
-                    Board b(h);
-                    if (b) {
-                        b.search(depth);
-                    }
-                }
-            }
+        Exporter exporter(hashtable, exportfd, only);
+        if (exportfd>=0) {
+            executor.add(exporter);
+        }
 
-            if (empty) {
-                if (hashtable[h] & ~LEGAL) {
-                    hashtable[h] &= LEGAL;
-                }
-            }
+        // counting is fused with scanning and clearing, so each position is
+        // counted before it is searched and cleared
+        Counter counter(hashtable);
+        // keep up to 16M positions of 16 bytes for escalation
+        Scanner scanner(hashtable, depth, pool.size(), escalate>depth ? (1<<24)/pool.size() : 0);
+
+        // a queue recorded by an interrupted escalation replaces the scan
+        std::string escalation = checkpointname ? std::string(checkpointname)+".escalate" : "";
+        int queued = scan && escalate>depth && checkpointname && scanner.resume(escalation.c_str(), start, stop);
+        int scanning = scan && !queued;
+        Cleaner cleaner(hashtable);
+        Fused<Counter, Scanner> counterScanner(hashtable, counter, scanner);
+        Fused<Counter, Cleaner> counterCleaner(hashtable, counter, cleaner);
+        Fused<Fused<Counter, Scanner>, Cleaner> counterScannerCleaner(hashtable, counterScanner, cleaner);
+        PlaneCounter planeCounter(planes);
+        if (scanning && empty) {
+            // search, then clear, as the positions go by
+            executor.add(counterScannerCleaner);
+        } else if (scanning) {
+            executor.add(counterScanner);
+        } else if (empty) {
+            executor.add(counterCleaner);
+        } else if (planes && !(print || split || exportfd>=0 || reportname || longest)) {
+            // counting only needs to read the bit planes
+            executor.add(planeCounter);
+        } else {
+            executor.add(counter);
+        }
+
+        Splitter splitter(hashtable, planes);
+        if (split) {
+            executor.add(splitter);
+        }
+
+        executor.run(t0);
+
+        if (executor.resumed) {
+            // the blocks before the checkpoint were counted by an earlier run
+            std::cout << "partial count from 0x" << std::hex << executor.resumed << std::dec << ": ";
+        }
+
+        uint64 counted = stop-(executor.resumed ? executor.resumed : start);
+        std::cout << executor.n << " positions (" << 100.0*executor.n/(counted/2) << "%), " << executor.w << " wins, " << executor.l << " losses";
+        if (planes && !(empty || print || scan || split || exportfd>=0 || reportname || longest)) {
+            std::cout << ", " << executor.u << " unresolved";
+        }
+
+        std::cout << std::endl;
+
+        if (scan && escalate>depth) {
+            scanner.escalate(pool, escalate);
+        }
+
+        if (reportname) {
+            reporter.write(reportname);
         }
 
-        std::cout << n << " positions (" << 100.0*n/((stop-start)/2) << "%), " << w << " wins, " << l << " losses" << std::endl;
+        if (longest) {
+            finder.print();
+        }
+    }
+
+    if (exportfd>=0) {
+        close(exportfd);
+    }
+
+    if (retro) {
+        // sweep until a wave resolves no more positions
+        Sweeper sweeper(hashtable, planes, hashtablename!=NULL);
+        for (int wave=1;; wave++) {
+            Executor executor(pool, start, stop, 16);
+            executor.add(sweeper);
+            executor.stats(statsname);
+            executor.run(t0);
+
+            std::cout << "wave " << wave << ": " << executor.w << " wins, " << executor.l << " losses" << std::endl;
+            if (!executor.w && !executor.l) {
+                break;
+            }
+        }
     }
 
     struct timeval t;